@@ -103,12 +103,15 @@ struct
  * - group = "adafruit", variable is "devname"
  * - "adafruit/devname" will be save to flash
  */
-const adacfg_info_t cfg_info[] =
-{
-    /* Name, Type, Size, Buffer */
-    { "devname", CONF_STRING, 32, cfgdata.devname },
+ADACFG_STRING("devname", cfgdata.devname);
+
+static void cfg_devname_changed(void* arg);
 
-    { 0 } /* Zero for null-terminator */
+/* Apply new device name without reboot when set from CLI/newtmgr */
+static adacfg_listener_t cfg_devname_listener =
+{
+    .name = "devname",
+    .cb   = cfg_devname_changed,
 };
 
 /*------------------------------------------------------------------*/
@@ -159,6 +162,23 @@ static void btle_advertise(void)
                 RETURN_VOID);
 }
 
+/**
+ * Config change callback, device name is updated and advertising restarted
+ * so that the scan response carries the new name.
+ */
+static void cfg_devname_changed(void* arg)
+{
+  (void) arg;
+
+  VERIFY_STATUS( ble_svc_gap_device_name_set(cfgdata.devname), RETURN_VOID );
+
+  if ( ble_gap_adv_active() )
+  {
+    ble_gap_adv_stop();
+    btle_advertise();
+  }
+}
+
 /**
  * The nimble host executes this callback when a GAP event occurs.  The
  * application associates a GAP event callback with each connection that forms.
@@ -249,7 +269,8 @@ int main(void)
 
   /* Init Config & NFFS */
   adacfg_init("adafruit");
-  adacfg_add(cfg_info);
+  adacfg_load();
+  adacfg_listen(&cfg_devname_listener);
 
   //------------- Task Init -------------//
   os_task_init(&bleuart_bridge_task, BLEUART_BRIDGE_NAME, bleuart_bridge_task_handler, NULL,
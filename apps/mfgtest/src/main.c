@@ -92,59 +92,23 @@ shell_i2cscan_cmd(int argc, char **argv)
     return 0;
 }
 
-static int
-orientation_listener(struct sensor *sensor, void *arg, void *data, sensor_type_t type)
-{
-    (void) type;
-
-    int rc;
-    struct sensor_accel_data *sad;
-    struct or_orientation_vec orv;
-
-    memset(&orv, 0, sizeof(orv));
-
-    sad = (struct sensor_accel_data *) data;
-
-    rc = or_from_accel(sad, &orv);
-
-    console_printf("r = %i, ", (int)orv.roll);
-    console_printf("p = %i ", (int)orv.pitch);
-    console_printf("\n");
-
-    return rc;
-}
-
-/* orientation command handler */
+/* orientation command handler, prints the latest sample of the stream */
 static int
 shell_orientation_cmd(int argc, char **argv)
 {
-    struct sensor *sensor;
-    struct sensor_listener listener;
-    int rc;
+    struct or_stream_sample sample;
 
-    /* Look up sensor by name */
-    sensor = sensor_mgr_find_next_bydevname("lsm303dlhc", NULL);
-    if (!sensor) {
-        console_printf("Sensor %s not found!\n", "lsm303dlhc");
+    if (or_stream_get(&sample) != 0) {
+        console_printf("No orientation data yet\n");
+        return 0;
     }
 
-    listener.sl_sensor_type = SENSOR_TYPE_ACCELEROMETER;
-    listener.sl_func = orientation_listener;
-    listener.sl_arg = NULL;
-    //listener.sl_arg = &ctx;
+    console_printf("r = %i, ", (int)sample.orv.roll);
+    console_printf("p = %i, ", (int)sample.orv.pitch);
+    console_printf("h = %i ", (int)sample.orv.heading);
+    console_printf("(#%lu, %lu ms ago)\n", (unsigned long)sample.seq,
+        (unsigned long)((os_time_get() - sample.ts) * 1000 / OS_TICKS_PER_SEC));
 
-    rc = sensor_register_listener(sensor, &listener);
-    if (rc != 0) {
-        goto err;
-    }
-
-    /* Get a fresh data sample (will be returned in the listener) */
-    rc = sensor_read(sensor, SENSOR_TYPE_ACCELEROMETER,
-        NULL, NULL, OS_TIMEOUT_NEVER);
-
-    sensor_unregister_listener(sensor, &listener);
-
-err:
     return 0;
 }
 
@@ -201,6 +165,8 @@ err:
 int
 main(int argc, char **argv)
 {
+    int rc;
+
     /* Initialize OS */
     sysinit();
 
@@ -219,6 +185,12 @@ main(int argc, char **argv)
     os_dev_create((struct os_dev *) &lsm303dlhc_sensor, "lsm303dlhc",
             OS_DEV_INIT_KERNEL, OS_DEV_INIT_PRIMARY, lsm303dlhc_drvr_init, NULL);
 
+    /* Shared by the shell command and any other orientation consumer */
+    rc = or_stream_start("lsm303dlhc", MYNEWT_VAL(ORIENTATION_STREAM_RATE_MS));
+    if (rc != 0) {
+        console_printf("Orientation stream failed: %d\n", rc);
+    }
+
     while (1) {
       os_eventq_run(os_eventq_dflt_get());
     }
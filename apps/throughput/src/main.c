@@ -41,6 +41,9 @@
 #include "bsp/bsp.h"
 #include "os/os.h"
 #include "hal/hal_gpio.h"
+#ifdef ARCH_sim
+#include <mcu/mcu_sim.h>
+#endif
 
 #include "sysinit/sysinit.h"
 #include <console/console.h>
@@ -57,6 +60,9 @@
 #include "newtmgr/newtmgr.h"
 #include "nmgrble/newtmgr_ble.h"
 
+/* Checksum of the generated test pattern */
+#include "crc/crc16.h"
+
 /* Crash test ... just because */
 #include "crash_test/crash_test.h"
 
@@ -78,6 +84,99 @@
 struct os_task blinky_task;
 os_stack_t blinky_stack[BLINKY_STACK_SIZE];
 
+/* Throughput test task settings. Lower priority than blinky so that a
+ * long running test never starves the rest of the system */
+#define NUSTEST_TASK_PRIO             (11)
+#define NUSTEST_STACK_SIZE            OS_STACK_ALIGN(384)
+
+struct os_task nustest_task;
+os_stack_t nustest_stack[NUSTEST_STACK_SIZE];
+
+/*------------------------------------------------------------------*/
+/* Throughput test settings
+ *------------------------------------------------------------------*/
+/* Largest packet that can be requested, limited by the max ATT MTU.
+ * Packets larger than the negotiated MTU are split into MTU-sized
+ * notifications */
+#define NUSTEST_MAX_PACKET_SIZE       (BLE_ATT_MTU_MAX - 3)
+
+/* Default duration of each configuration run by 'nustest sweep' */
+#define NUSTEST_SWEEP_DURATION        (10)
+
+/* Pattern generator state. Byte n of the stream is '0' + (n % 10), so the
+ * peer can regenerate the exact same data at any offset and verify it
+ * together with the running CRC16-CCITT reported at the end of the test */
+typedef struct
+{
+  uint32_t offset; ///< number of bytes sent so far
+  uint8_t  digit;  ///< next pattern digit (0-9)
+  uint16_t crc;    ///< CRC16-CCITT of all bytes sent so far
+} nustest_gen_t;
+
+/* Parameters of one test run */
+typedef struct
+{
+  uint32_t count;    ///< number of packets, 0 to run for duration instead
+  uint32_t duration; ///< run time in os ticks when count is 0
+  uint16_t size;     ///< packet size
+  uint16_t mtu;      ///< cap on the negotiated MTU, 0 for no cap
+  uint16_t batch;    ///< notifications queued before yielding, 0 for no limit
+} nustest_param_t;
+
+/* Results of one test run */
+typedef struct
+{
+  uint32_t packets;
+  uint32_t bytes;
+  uint32_t ms;
+  uint32_t load;   ///< CPU load in permille
+  uint32_t cycles; ///< busy cycles per byte, 0 if unknown
+  uint16_t mtu;    ///< MTU in effect: negotiated, capped by param mtu
+  uint16_t crc;
+  bool     aborted;
+} nustest_result_t;
+
+/* Configurations iterated by 'nustest sweep' */
+static const uint16_t _sweep_size [] = { 20, 64, 128, 244 };
+static const uint16_t _sweep_mtu  [] = { 23, 64, 128, 247 };
+static const uint16_t _sweep_batch[] = { 1, 4, 0 };
+
+static struct
+{
+  struct os_sem start_sem;
+  volatile bool running;
+  volatile bool abort;
+
+  bool sweep;
+  bool sweep_nus; ///< send sweep results over bleuart instead of console
+
+  nustest_param_t  param;
+  nustest_result_t result;
+  nustest_gen_t    gen;
+} _nustest;
+
+static uint8_t _nustest_buf[NUSTEST_MAX_PACKET_SIZE];
+
+/*------------------------------------------------------------------*/
+/* CPU usage accounting
+ *------------------------------------------------------------------*/
+/* Max number of tasks tracked, indexed by task id */
+#define NUSTEST_MAX_TASKS             (16)
+
+/* CPU clock used to convert busy time into cycles, not available on sim */
+#if defined(NRF52) || defined(NRF51)
+  #define NUSTEST_CPU_HZ              SystemCoreClock
+#endif
+
+/* Run time of every task (in os ticks) as accounted by the scheduler */
+typedef struct
+{
+  os_time_t tick;
+  uint32_t  runtime[NUSTEST_MAX_TASKS];
+} cpu_snapshot_t;
+
+static cpu_snapshot_t _cpu_start, _cpu_end;
+
 /*------------------------------------------------------------------*/
 /* Global values
  *------------------------------------------------------------------*/
@@ -99,61 +198,423 @@ static struct shell_cmd cmd_nustest =
 };
 
 /**
- *  'nustest' shell command handler
+ * Fill buffer with the next len bytes of the test pattern
+ * @param gen  generator state
+ * @param buf  destination buffer
+ * @param len  number of bytes to generate
+ */
+static void nustest_gen_fill(nustest_gen_t* gen, uint8_t* buf, uint16_t len)
+{
+  uint8_t digit = gen->digit;
+
+  for(uint16_t i=0; i<len; i++)
+  {
+    buf[i] = '0' + digit;
+    if ( ++digit == 10 ) digit = 0;
+  }
+
+  gen->digit = digit;
+}
+
+/**
+ * 'nustest' shell command handler
  */
 static int cmd_nustest_exec(int argc, char **argv)
 {
-  /* 1st arg is number of packet (default 100)
-   * 2nd arg is size of each packet (deault 20)
+  /* nustest [count] [size]          : send count packets (default 100 x 20 bytes)
+   * nustest sweep [seconds] [nus]   : run every size/MTU/batch combination for
+   *                                   seconds each and print a CSV table, to
+   *                                   bleuart instead of console if 'nus' is given
+   * nustest stop                    : abort a running test or sweep
    */
 
-  uint32_t count = (argc > 1) ? strtoul(argv[1], NULL, 10) : 100;
-  uint32_t size  = (argc > 2) ? strtoul(argv[2], NULL, 10) : 20;
+  if ( (argc > 1) && !strcmp(argv[1], "stop") )
+  {
+    _nustest.abort = true;
+    return 0;
+  }
 
-  if ( count > 100 )
+  if ( _nustest.running )
   {
-    printf("count must not exceed 100\n");
+    printf("nustest is already running, use 'nustest stop' to abort\n");
     return -1;
   }
 
-  if ( size > 240 )
+  if ( bleuart_mtu() == 0 )
   {
-    printf("size must not exceed 240\n");
+    printf("not connected\n");
     return -1;
   }
 
-  uint32_t total = count * size;
+  varclr(_nustest.param);
+
+  if ( (argc > 1) && !strcmp(argv[1], "sweep") )
+  {
+    uint32_t const seconds = (argc > 2) ? strtoul(argv[2], NULL, 10) : NUSTEST_SWEEP_DURATION;
 
-  char *data = malloc(size);
-  if(!data) return (-1);
+    if ( seconds == 0 )
+    {
+      printf("duration must be at least 1 second\n");
+      return -1;
+    }
 
-  for(uint8_t i=0; i<size; i++)
+    _nustest.sweep          = true;
+    _nustest.sweep_nus      = (argc > 3) && !strcmp(argv[3], "nus");
+    _nustest.param.duration = seconds * OS_TICKS_PER_SEC;
+  }
+  else
   {
-    data[i] = i%10 + '0';
+    uint32_t count = (argc > 1) ? strtoul(argv[1], NULL, 10) : 100;
+    uint32_t size  = (argc > 2) ? strtoul(argv[2], NULL, 10) : 20;
+
+    if ( count == 0 )
+    {
+      printf("count must be at least 1\n");
+      return -1;
+    }
+
+    if ( size == 0 || size > NUSTEST_MAX_PACKET_SIZE )
+    {
+      printf("size must be between 1 and %u\n", NUSTEST_MAX_PACKET_SIZE);
+      return -1;
+    }
+
+    _nustest.sweep       = false;
+    _nustest.param.count = count;
+    _nustest.param.size  = size;
   }
 
-  /* Negotiate a larger MTU if size > 20 */
-  if ( size > 20 )
+  _nustest.abort   = false;
+  _nustest.running = true;
+
+  /* Actual sending is done by nustest task, leaving the shell responsive */
+  os_sem_release(&_nustest.start_sem);
+
+  return 0;
+}
+
+/**
+ * Send one packet of the test pattern, waiting for free buffers when the
+ * stack runs out of them. Packets larger than the (capped) MTU are split
+ * into several notifications.
+ * @param param    test parameters
+ * @param result   MTU in effect is recorded
+ * @param pending  notifications queued since the last yield, updated
+ * @return true if the whole packet is sent, false if the test is aborted
+ */
+static bool nustest_send_packet(nustest_param_t const* param, nustest_result_t* result, uint16_t* pending)
+{
+  uint32_t size = param->size;
+
+  while ( size )
   {
-    ble_gattc_exchange_mtu(conn_handle, NULL, NULL);
-    /* wait for the MTU procedure to complete. We could use a callback */
-    /* but for now we simply delay 500 ms */
-    os_time_delay(500);
+    /* MTU is zero once the connection is gone */
+    uint16_t mtu = bleuart_mtu();
+    if ( _nustest.abort || mtu == 0 ) return false;
+
+    if ( param->mtu ) mtu = min16(mtu, param->mtu);
+    result->mtu = mtu;
+
+    uint16_t const len = min16(size, mtu - 3);
+
+    nustest_gen_fill(&_nustest.gen, _nustest_buf, len);
+
+    /* Flow control: notification fails when all mbufs are in use, retry
+     * the same chunk on the next tick once the controller freed some */
+    while ( bleuart_write(_nustest_buf, len) != len )
+    {
+      if ( _nustest.abort || bleuart_mtu() == 0 ) return false;
+      os_time_delay(1);
+      (*pending) = 0;
+    }
+
+    _nustest.gen.crc     = crc16_ccitt(_nustest.gen.crc, _nustest_buf, len);
+    _nustest.gen.offset += len;
+    size -= len;
+
+    /* Batch depth: yield after this many back-to-back notifications */
+    if ( param->batch && (++(*pending) >= param->batch) )
+    {
+      os_time_delay(1);
+      (*pending) = 0;
+    }
   }
 
-  for(uint8_t i=0; i<count; i++)
+  return true;
+}
+
+/**
+ * Record current run time of all tasks
+ * @param snap
+ */
+static void cpu_snapshot_take(cpu_snapshot_t* snap)
+{
+  struct os_task_info oti;
+  struct os_task* task = NULL;
+
+  varclr(*snap);
+  snap->tick = os_time_get();
+
+  while ( (task = os_task_info_get_next(task, &oti)) != NULL )
   {
-    bleuart_write(data, size);
+    if ( oti.oti_taskid < NUSTEST_MAX_TASKS ) snap->runtime[oti.oti_taskid] = oti.oti_runtime;
   }
+}
 
-  free(data);
+/**
+ * Time spent in the idle task between two snapshots
+ * @return idle time in os ticks
+ */
+static uint32_t cpu_idle_ticks(cpu_snapshot_t const* start, cpu_snapshot_t const* end)
+{
+  struct os_task_info oti;
+  struct os_task* task = NULL;
 
-  /* Print the results */
-  printf("Submitted %lu bytes (%lu packets of %lu size)\n", total, count, size);
+  while ( (task = os_task_info_get_next(task, &oti)) != NULL )
+  {
+    if ( !strcmp(oti.oti_name, "idle") && oti.oti_taskid < NUSTEST_MAX_TASKS )
+    {
+      return end->runtime[oti.oti_taskid] - start->runtime[oti.oti_taskid];
+    }
+  }
 
   return 0;
 }
 
+/**
+ * Compute CPU load and cost per byte between two snapshots
+ * @param bytes   number of bytes sent during the test
+ * @param result  load and cycles fields are populated
+ */
+static void cpu_usage(cpu_snapshot_t const* start, cpu_snapshot_t const* end, uint32_t bytes,
+                      nustest_result_t* result)
+{
+  uint32_t const total = max32(1, end->tick - start->tick);
+  uint32_t const busy  = total - min32(total, cpu_idle_ticks(start, end));
+
+  /* permille for one decimal without floating point */
+  result->load = (busy * 1000) / total;
+
+#ifdef NUSTEST_CPU_HZ
+  uint64_t const cycles = ((uint64_t) busy * NUSTEST_CPU_HZ) / OS_TICKS_PER_SEC;
+  result->cycles = cycles / max32(1, bytes);
+#else
+  (void) bytes;
+  result->cycles = 0;
+#endif
+}
+
+/**
+ * Print per-task run time between two snapshots
+ */
+static void cpu_report_tasks(cpu_snapshot_t const* start, cpu_snapshot_t const* end)
+{
+  uint32_t const total = max32(1, end->tick - start->tick);
+
+  struct os_task_info oti;
+  struct os_task* task = NULL;
+
+  while ( (task = os_task_info_get_next(task, &oti)) != NULL )
+  {
+    if ( oti.oti_taskid >= NUSTEST_MAX_TASKS ) continue;
+
+    uint32_t const runtime = end->runtime[oti.oti_taskid] - start->runtime[oti.oti_taskid];
+    uint32_t const percent = (runtime * 1000) / total;
+
+    printf("  %-12s %6lu ticks %3lu.%lu%%\n", oti.oti_name, (unsigned long) runtime,
+           (unsigned long) percent / 10, (unsigned long) percent % 10);
+  }
+}
+
+/**
+ * Run one test with given parameters
+ * @param param   test parameters
+ * @param result  populated with the test results
+ */
+static void nustest_run(nustest_param_t const* param, nustest_result_t* result)
+{
+  uint16_t pending = 0;
+
+  varclr(*result);
+  varclr(_nustest.gen);
+  _nustest.gen.crc = CRC16_INITIAL_CRC;
+
+#if MYNEWT_VAL(BLEUART_SIM)
+  bleuart_sim_stats_reset();
+#endif
+
+  cpu_snapshot_take(&_cpu_start);
+
+  while ( param->count ? (result->packets < param->count)
+                       : (os_time_get() - _cpu_start.tick < param->duration) )
+  {
+    if ( !nustest_send_packet(param, result, &pending) )
+    {
+      result->aborted = true;
+      break;
+    }
+
+    result->packets++;
+  }
+
+  cpu_snapshot_take(&_cpu_end);
+
+  result->bytes = _nustest.gen.offset;
+  result->crc   = _nustest.gen.crc;
+  result->ms    = ((_cpu_end.tick - _cpu_start.tick) * 1000) / OS_TICKS_PER_SEC;
+
+  cpu_usage(&_cpu_start, &_cpu_end, result->bytes, result);
+
+#if MYNEWT_VAL(BLEUART_SIM)
+  /* Let the simulated link drain the remaining packets, so that the next
+   * run starts with empty buffers */
+  bleuart_sim_stats_t stats;
+  do
+  {
+    os_time_delay(OS_TICKS_PER_SEC / 10);
+    bleuart_sim_stats_get(&stats);
+  } while ( stats.tx_bytes < result->bytes );
+#endif
+}
+
+/**
+ * Throughput of a run, 0 if it took less than a millisecond
+ */
+static uint32_t nustest_kbps(nustest_result_t const* result)
+{
+  return result->ms ? (result->bytes * 8) / result->ms : 0;
+}
+
+/**
+ * Print results of a single 'nustest' run
+ */
+static void nustest_print(nustest_param_t const* param, nustest_result_t const* result)
+{
+  printf("%s %lu bytes (%lu packets of %lu size) in %lu ms, %lu kbit/s, crc16 = 0x%04X\n",
+         result->aborted ? "Aborted after" : "Submitted",
+         (unsigned long) result->bytes, (unsigned long) result->packets, (unsigned long) param->size,
+         (unsigned long) result->ms, (unsigned long) nustest_kbps(result), result->crc);
+
+  printf("CPU load %lu.%lu%%", (unsigned long) result->load / 10, (unsigned long) result->load % 10);
+  if ( result->cycles ) printf(", %lu cycles/byte", (unsigned long) result->cycles);
+  printf("\n");
+
+  cpu_report_tasks(&_cpu_start, &_cpu_end);
+
+#if MYNEWT_VAL(BLEUART_SIM)
+  bleuart_sim_stats_t stats;
+  bleuart_sim_stats_get(&stats);
+
+  uint32_t avg_ms, max_ms;
+  os_time_ticks_to_ms(stats.latency_sum / max32(1, stats.tx_pkts), &avg_ms);
+  os_time_ticks_to_ms(stats.latency_max, &max_ms);
+
+  printf("Sim link: %lu packets in %lu conn events, %lu queue full, latency avg %lu ms max %lu ms, peer crc16 = 0x%04X\n",
+         (unsigned long) stats.tx_pkts, (unsigned long) stats.conn_events, (unsigned long) stats.txq_full,
+         (unsigned long) avg_ms, (unsigned long) max_ms, stats.crc);
+#endif
+}
+
+/**
+ * Output one line of the sweep table, to console or bleuart. Writing to
+ * bleuart happens between runs so it does not disturb the measurement.
+ */
+static void nustest_sweep_puts(const char* line)
+{
+  if ( _nustest.sweep_nus )
+  {
+    uint32_t const len = strlen(line);
+    uint32_t sent = 0;
+
+    while ( sent < len && bleuart_mtu() )
+    {
+      uint16_t const n = min32(len - sent, bleuart_mtu() - 3);
+
+      if ( bleuart_write(line + sent, n) == n ) sent += n;
+      else os_time_delay(1);
+    }
+  }
+  else
+  {
+    printf("%s", line);
+  }
+}
+
+/**
+ * Run every size/MTU/batch configuration for the configured duration and
+ * output results as CSV
+ */
+static void nustest_sweep(void)
+{
+  char line[96];
+
+  /* mtu_cap is the configured cap, mtu the one in effect with the peer */
+  nustest_sweep_puts("size,mtu_cap,mtu,batch,bytes,ms,kbps,load_permille,cycles_per_byte,crc16\n");
+
+  for(uint8_t s=0; s<arrcount(_sweep_size); s++)
+  {
+    for(uint8_t m=0; m<arrcount(_sweep_mtu); m++)
+    {
+      for(uint8_t b=0; b<arrcount(_sweep_batch); b++)
+      {
+        _nustest.param.size  = _sweep_size[s];
+        _nustest.param.mtu   = _sweep_mtu[m];
+        _nustest.param.batch = _sweep_batch[b];
+
+        nustest_run(&_nustest.param, &_nustest.result);
+        if ( _nustest.result.aborted ) return;
+
+        nustest_result_t const* res = &_nustest.result;
+
+        snprintf(line, sizeof(line), "%u,%u,%u,%u,%lu,%lu,%lu,%lu,%lu,0x%04X\n",
+                 _nustest.param.size, _nustest.param.mtu, res->mtu, _nustest.param.batch,
+                 (unsigned long) res->bytes, (unsigned long) res->ms,
+                 (unsigned long) nustest_kbps(res),
+                 (unsigned long) res->load, (unsigned long) res->cycles, res->crc);
+
+        nustest_sweep_puts(line);
+      }
+    }
+  }
+}
+
+/**
+ * Throughput test task handler
+ */
+void nustest_task_handler(void* arg)
+{
+  (void) arg;
+
+  while(1)
+  {
+    os_sem_pend(&_nustest.start_sem, OS_TIMEOUT_NEVER);
+
+#if !MYNEWT_VAL(BLEUART_SIM)
+    /* Negotiate a larger MTU for anything above the default payload */
+    if ( _nustest.sweep || _nustest.param.size > 20 )
+    {
+      ble_gattc_exchange_mtu(conn_handle, NULL, NULL);
+      /* wait for the MTU procedure to complete. We could use a callback */
+      /* but for now we simply delay 500 ms */
+      os_time_delay(OS_TICKS_PER_SEC / 2);
+    }
+#endif
+
+    if ( _nustest.sweep )
+    {
+      nustest_sweep();
+      printf("Sweep %s\n", _nustest.result.aborted ? "aborted" : "completed");
+    }
+    else
+    {
+      nustest_run(&_nustest.param, &_nustest.result);
+      nustest_print(&_nustest.param, &_nustest.result);
+    }
+
+    _nustest.running = false;
+  }
+}
+
 /**
  * Enables advertising with the following parameters:
  *     o General discoverable mode.
@@ -234,6 +695,8 @@ static int btle_gap_event(struct ble_gap_event *event, void *arg)
 
     case BLE_GAP_EVENT_DISCONNECT:
       /* Connection terminated; resume advertising. */
+      conn_handle = BLE_HS_CONN_HANDLE_NONE;
+      bleuart_set_conn_handle(conn_handle);
       btle_advertise();
     return 0;
 
@@ -274,8 +737,12 @@ void blinky_task_handler(void* arg)
  *
  * @return int NOTE: this function should never return!
  */
-int main(void)
+int main(int argc, char **argv)
 {
+#ifdef ARCH_sim
+  mcu_sim_parse_args(argc, argv);
+#endif
+
   /* Initialize OS */
   sysinit();
 
@@ -286,6 +753,10 @@ int main(void)
   os_task_init(&blinky_task, "blinky", blinky_task_handler, NULL,
                BLINKY_TASK_PRIO, OS_WAIT_FOREVER, blinky_stack, BLINKY_STACK_SIZE);
 
+  os_sem_init(&_nustest.start_sem, 0);
+  os_task_init(&nustest_task, "nustest", nustest_task_handler, NULL,
+               NUSTEST_TASK_PRIO, OS_WAIT_FOREVER, nustest_stack, NUSTEST_STACK_SIZE);
+
   /* Initialize the BLE host. */
   ble_hs_cfg.sync_cb        = btle_on_sync;
 //  ble_hs_cfg.store_read_cb  = ble_store_ram_read;
@@ -297,7 +768,7 @@ int main(void)
   /* Nordic UART service (NUS) settings */
   bleuart_init();
 
-  /* Command usage: nustest <count> <packetsize> */
+  /* Command usage: nustest <count> <packetsize> | nustest sweep [seconds] [nus] | nustest stop */
   shell_cmd_register(&cmd_nustest);
 
   /* Set the default device name. */
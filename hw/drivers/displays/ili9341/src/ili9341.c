@@ -68,8 +68,17 @@ STATS_SECT_DECL(ili9341_stat_section) g_ili9341stats;
 
 #if MYNEWT_VAL(ILI9341_LOG)
 #define LOG_MODULE_ILI9341    (9341)
+/* Levels below ILI9341_LOG_LEVEL compile to nothing */
+#if MYNEWT_VAL(ILI9341_LOG_LEVEL) <= LOG_LEVEL_INFO
 #define ILI9341_INFO(...)     LOG_INFO(&_log, LOG_MODULE_ILI9341, __VA_ARGS__)
+#else
+#define ILI9341_INFO(...)
+#endif
+#if MYNEWT_VAL(ILI9341_LOG_LEVEL) <= LOG_LEVEL_ERROR
 #define ILI9341_ERR(...)      LOG_ERROR(&_log, LOG_MODULE_ILI9341, __VA_ARGS__)
+#else
+#define ILI9341_ERR(...)
+#endif
 static struct log _log;
 #else
 #define ILI9341_INFO(...)
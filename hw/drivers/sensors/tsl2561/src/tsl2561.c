@@ -82,8 +82,17 @@ STATS_SECT_DECL(tsl2561_stat_section) g_tsl2561stats;
 
 #if MYNEWT_VAL(TSL2561_LOG)
 #define LOG_MODULE_TSL2561    (2561)
+/* Levels below TSL2561_LOG_LEVEL compile to nothing */
+#if MYNEWT_VAL(TSL2561_LOG_LEVEL) <= LOG_LEVEL_INFO
 #define TSL2561_INFO(...)     LOG_INFO(&_log, LOG_MODULE_TSL2561, __VA_ARGS__)
+#else
+#define TSL2561_INFO(...)
+#endif
+#if MYNEWT_VAL(TSL2561_LOG_LEVEL) <= LOG_LEVEL_ERROR
 #define TSL2561_ERR(...)      LOG_ERROR(&_log, LOG_MODULE_TSL2561, __VA_ARGS__)
+#else
+#define TSL2561_ERR(...)
+#endif
 static struct log _log;
 #else
 #define TSL2561_INFO(...)
@@ -36,10 +36,15 @@
 #ifndef ADA_CFG_H_
 #define ADA_CFG_H_
 
+#include <stdbool.h>
+#include <os/queue.h>
 #include <config/config.h>
+#include "compiler_macro.h"
+#include "verify.h"
 
-#ifndef CFG_ADACFG_MAXCONFIG
-#define CFG_ADACFG_MAXCONFIG 10
+/* Max number of variables, both declared with ADACFG_xxx() and added */
+#ifndef CFG_ADACFG_MAXVAR
+#define CFG_ADACFG_MAXVAR    32
 #endif
 
 #ifdef __cplusplus
@@ -54,8 +59,60 @@ typedef struct
   void* value;
 } adacfg_info_t;
 
+/*------------------------------------------------------------------*/
+/* Compile-time schema
+ * Declare a variable at file scope e.g ADACFG_STRING("devname", cfgdata.devname);
+ * Descriptors are placed in the adacfg_schema section and picked up by
+ * adacfg_init() without adacfg_add(). Variable size is checked against the
+ * type at build time.
+ *------------------------------------------------------------------*/
+/* Explicit alignment stops the compiler from padding entries, the section
+ * must be a plain array of adacfg_info_t */
+#define _ADACFG_DECLARE(_name, _type, _len, _var) \
+  static const adacfg_info_t XSTRING_CONCAT_(_adacfg_schema_, __LINE__) \
+    ATTR_SECTION(adacfg_schema) ATTR_USED ATTR_ALIGNED(ALIGN_OF(adacfg_info_t)) = \
+    { .name = _name, .type = _type, .len = _len, .value = (void*) &(_var) }
+
+#define _ADACFG_SCALAR(_name, _type, _var, _size) \
+  VERIFY_STATIC(sizeof(_var) == _size, "size mismatch with config type"); \
+  _ADACFG_DECLARE(_name, _type, _size, _var)
+
+/* Must be an array, not a pointer */
+#define _ADACFG_ARRAY(_name, _type, _var) \
+  VERIFY_STATIC(!__builtin_types_compatible_p(__typeof__(_var), __typeof__(&(_var)[0])), "config string/bytes must be an array"); \
+  _ADACFG_DECLARE(_name, _type, sizeof(_var), _var)
+
+#define ADACFG_INT8(_name, _var)    _ADACFG_SCALAR(_name, CONF_INT8  , _var, 1)
+#define ADACFG_INT16(_name, _var)   _ADACFG_SCALAR(_name, CONF_INT16 , _var, 2)
+#define ADACFG_INT32(_name, _var)   _ADACFG_SCALAR(_name, CONF_INT32 , _var, 4)
+#define ADACFG_INT64(_name, _var)   _ADACFG_SCALAR(_name, CONF_INT64 , _var, 8)
+#define ADACFG_BOOL(_name, _var)    _ADACFG_SCALAR(_name, CONF_BOOL  , _var, 1)
+#define ADACFG_FLOAT(_name, _var)   _ADACFG_SCALAR(_name, CONF_FLOAT , _var, 4)
+#define ADACFG_DOUBLE(_name, _var)  _ADACFG_SCALAR(_name, CONF_DOUBLE, _var, 8)
+#define ADACFG_STRING(_name, _var)  _ADACFG_ARRAY(_name, CONF_STRING, _var)
+#define ADACFG_BYTES(_name, _var)   _ADACFG_ARRAY(_name, CONF_BYTES , _var)
+
+/* Change listener, see adacfg_listen().
+ * name: variable name, group prefix ending with '/' or NULL for all */
+typedef struct adacfg_listener
+{
+  const char* name;
+  void (*cb)(void* arg);
+  void* arg;
+
+  SLIST_ENTRY(adacfg_listener) next;
+} adacfg_listener_t;
+
+/* Export filter, return false to skip exporting var to tgt */
+typedef bool (*adacfg_filter_t)(const adacfg_info_t* var, enum conf_export_tgt tgt);
+
 int adacfg_init(const char* prefix);
 int adacfg_add(const adacfg_info_t* cfg);
+int adacfg_load(void);
+int adacfg_set_dirty(const char* name);
+int adacfg_save(void);
+void adacfg_set_export_filter(adacfg_filter_t filter);
+int adacfg_listen(adacfg_listener_t* listener);
 
 
 #ifdef __cplusplus
@@ -0,0 +1,133 @@
+/**************************************************************************/
+/*!
+    @file     ada_gatt.h
+    @author   hathach
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2016, Adafruit Industries (adafruit.com)
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/**************************************************************************/
+#ifndef ADA_GATT_H_
+#define ADA_GATT_H_
+
+#include "syscfg/syscfg.h"
+#include "host/ble_hs.h"
+#include "compiler_macro.h"
+#include "common_func.h"
+
+#if MYNEWT_VAL(ADAUTIL_GATT_STATS)
+#include <stats/stats.h>
+#endif
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* Table driven GATT service. Characteristics are described by a const
+ * adagatt_chr_t table, reads and writes of all of them go through a single
+ * access callback that serves the value straight from its static buffer.
+ *
+ *   static uint8_t  _level;
+ *   static const adagatt_chr_t _bas_chr[] =
+ *   {
+ *     { .name = "level", .uuid = BLE_UUID16_DECLARE(0x2A19), .flags = BLE_GATT_CHR_F_READ,
+ *       .value = &_level, .max_len = 1 },
+ *   };
+ *   ADAGATT_SERVICE_DEF(_bas_svc, "ble_bas", BLE_UUID16_DECLARE(0x180F), _bas_chr);
+ *
+ *   adagatt_register(&_bas_svc);
+ */
+
+struct ble_gatt_access_ctxt;
+
+typedef struct
+{
+  const char*       name;       ///< stats name
+  ble_uuid_t const* uuid;
+  uint16_t          flags;      ///< BLE_GATT_CHR_F_xxx
+
+  void*             value;      ///< static value buffer, NULL if not stored
+  uint16_t*         len;        ///< current length, NULL if always max_len
+  uint16_t          max_len;
+
+  uint16_t*         val_handle; ///< optional, filled in at registration
+
+  /* Optional, called after a write is stored. om is the written data, which
+   * is the only copy for characteristics without value buffer */
+  void (*on_write)(uint16_t conn_hdl, struct os_mbuf* om);
+} adagatt_chr_t;
+
+typedef struct
+{
+  const char*       name;
+  ble_uuid_t const* uuid;
+
+  adagatt_chr_t const* chars;
+  uint8_t count;
+
+  struct ble_gatt_chr_def* chr_def; ///< count+1 entries, filled by adagatt_register()
+  struct ble_gatt_svc_def* svc_def; ///< 2 entries
+
+#if MYNEWT_VAL(ADAUTIL_GATT_STATS)
+  struct stats_hdr*      stats;     ///< followed by count 32-bit counters
+  struct stats_name_map* stat_names;
+#endif
+} adagatt_svc_t;
+
+#if MYNEWT_VAL(ADAUTIL_GATT_STATS)
+  #define _ADAGATT_STATS_DEF(_name, _n) \
+    static struct { struct stats_hdr hdr; uint32_t cnt[_n]; } _name##_stats; \
+    static struct stats_name_map _name##_stat_names[_n];
+
+  #define _ADAGATT_STATS_INIT(_name) \
+    .stats = &_name##_stats.hdr, .stat_names = _name##_stat_names,
+#else
+  #define _ADAGATT_STATS_DEF(_name, _n)
+  #define _ADAGATT_STATS_INIT(_name)
+#endif
+
+/* Declare a service from a characteristic table, all storage is static */
+#define ADAGATT_SERVICE_DEF(_name, _str, _uuid, _chars) \
+  static struct ble_gatt_chr_def _name##_chr_def[arrcount(_chars)+1]; \
+  static struct ble_gatt_svc_def _name##_svc_def[2]; \
+  _ADAGATT_STATS_DEF(_name, arrcount(_chars)) \
+  static adagatt_svc_t _name = \
+  { \
+    .name = _str, .uuid = _uuid, .chars = _chars, .count = arrcount(_chars), \
+    .chr_def = _name##_chr_def, .svc_def = _name##_svc_def, \
+    _ADAGATT_STATS_INIT(_name) \
+  }
+
+int adagatt_register(adagatt_svc_t* svc);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* ADA_GATT_H_ */
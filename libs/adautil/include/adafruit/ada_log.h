@@ -41,18 +41,111 @@
  extern "C" {
 #endif
 
+#include <stdint.h>
+#include "os/queue.h"
 #include "log/log.h"
 
 #define LOG_MODULE_ADA      0xAD
 
-#define ADALOG(lvl, ...)    LOG_##lvl(&adalog, LOG_MODULE_ADA, __VA_ARGS__)
+/* Compile-time level filter. A call below the module level (or the global
+ * LOG_LEVEL) is dead code: arguments are never evaluated and the format
+ * string is dropped by the compiler. Modules define their own level e.g
+ *   #define BLEDIS_LOG(lvl, ...) ADALOG_LVL(MYNEWT_VAL(BLEDIS_LOG_LEVEL), lvl, __VA_ARGS__) */
+#define ADALOG_ENABLED(_min, lvl) \
+  ( LOG_LEVEL_##lvl >= (_min) && LOG_LEVEL_##lvl >= MYNEWT_VAL(LOG_LEVEL) )
+
+#define ADALOG(lvl, ...)    ADALOG_LVL(MYNEWT_VAL(ADAUTIL_LOG_LEVEL), lvl, __VA_ARGS__)
+
+#if MYNEWT_VAL(ADAUTIL_LOG_BINARY)
+
+/* Binary mode: the format string is placed in the adalog_fmt section and
+ * only its offset plus up to 6 raw 32-bit arguments are recorded. Formatting
+ * is deferred, so %s arguments must point to constant strings, and float
+ * or 64-bit arguments are not supported. */
+#define ADALOG_LVL(_min, lvl, ...) \
+  do { \
+    if ( ADALOG_ENABLED(_min, lvl) ) { \
+      static const char _adalog_fmt[] ATTR_SECTION(adalog_fmt) = _ADALOG_FMT(__VA_ARGS__, 0); \
+      uint32_t const _adalog_args[] = { 0, _ADALOG_ARGS(__VA_ARGS__) }; \
+      adalog_bin_write(LOG_LEVEL_##lvl, _adalog_fmt, arrcount(_adalog_args)-1, _adalog_args+1); \
+    } \
+  } while(0)
+
+#define _ADALOG_FMT(_fmt, ...)                _fmt
+#define _ADALOG_CAST(_x)                      ((uint32_t) (uintptr_t) (_x))
+
+#define _ADALOG_ARGS_1(f)
+#define _ADALOG_ARGS_2(f,a)                   _ADALOG_CAST(a)
+#define _ADALOG_ARGS_3(f,a,b)                 _ADALOG_ARGS_2(f,a), _ADALOG_CAST(b)
+#define _ADALOG_ARGS_4(f,a,b,c)               _ADALOG_ARGS_3(f,a,b), _ADALOG_CAST(c)
+#define _ADALOG_ARGS_5(f,a,b,c,d)             _ADALOG_ARGS_4(f,a,b,c), _ADALOG_CAST(d)
+#define _ADALOG_ARGS_6(f,a,b,c,d,e)           _ADALOG_ARGS_5(f,a,b,c,d), _ADALOG_CAST(e)
+#define _ADALOG_ARGS_7(f,a,b,c,d,e,g)         _ADALOG_ARGS_6(f,a,b,c,d,e), _ADALOG_CAST(g)
+#define _ADALOG_ARGS_SEL(_1,_2,_3,_4,_5,_6,_7,N,...)  N
+#define _ADALOG_ARGS(...) \
+  _ADALOG_ARGS_SEL(__VA_ARGS__, _ADALOG_ARGS_7, _ADALOG_ARGS_6, _ADALOG_ARGS_5, _ADALOG_ARGS_4, \
+                   _ADALOG_ARGS_3, _ADALOG_ARGS_2, _ADALOG_ARGS_1, 0)(__VA_ARGS__)
+
+#define ADALOG_BIN_MAX_ARGS   6
+
+/* Record in the binary ring, followed by argc 32-bit arguments */
+typedef struct
+{
+  uint16_t fmt_off; ///< offset of format string in adalog_fmt section
+  uint8_t  level;
+  uint8_t  argc;
+  uint32_t ts;      ///< os_time_get() when logged
+} adalog_bin_rec_t;
+
+void adalog_bin_write(uint8_t level, const char* fmt, uint8_t argc, uint32_t const* args);
+bool adalog_bin_read(adalog_bin_rec_t* rec, uint32_t* args);
+const char* adalog_bin_fmt(adalog_bin_rec_t const* rec);
+uint32_t adalog_bin_dropped(void);
+
+#else
+
+#define ADALOG_LVL(_min, lvl, ...) \
+  do { \
+    if ( ADALOG_ENABLED(_min, lvl) ) LOG_##lvl(&adalog, LOG_MODULE_ADA, __VA_ARGS__); \
+  } while(0)
+
+#endif
+
 #define ADALOG_INFO(...)    ADALOG(INFO, __VA_ARGS__)
 #define ADALOG_DEBUG(...)   ADALOG(DEBUG, __VA_ARGS__)
 
 void adalog_init(void);
 
+#if MYNEWT_VAL(ADAUTIL_LOG_CRASH) && MYNEWT_VAL(SELFTEST)
+void adalog_crash_reboot(bool corrupt);
+#endif
+
+#if MYNEWT_VAL(ADAUTIL_LOG_ASYNC)
+
+/* Output of the log task e.g console, flash, bleuart */
+typedef struct adalog_sink
+{
+  void (*write)(const char* data, uint16_t len, void* arg);
+  void (*flush)(void* arg); ///< optional, called when the queue is empty
+  void* arg;
+
+  SLIST_ENTRY(adalog_sink) next;
+} adalog_sink_t;
+
+void adalog_add_sink(adalog_sink_t* sink);
+void adalog_sink_write(const char* data, uint16_t len);
+void adalog_sink_flush(void);
+uint32_t adalog_dropped(void);
+
+#endif
+
 extern struct log adalog;
 
+#if MYNEWT_VAL(ADAUTIL_LOG_CRASH)
+/* Entries recovered from previous boot */
+extern struct log adalog_crash;
+#endif
+
 #ifdef __cplusplus
  }
 #endif
@@ -46,10 +46,91 @@
 #include <config/config.h>
 #include <config/config_file.h>
 
+#if MYNEWT_VAL(ADAUTIL_CFG_STATS)
+#include <stats/stats.h>
+#endif
+
+#if MYNEWT_VAL(ADAUTIL_CFG_FCB)
+#include <fcb/fcb.h>
+#include <flash_map/flash_map.h>
+#endif
+
+#if MYNEWT_VAL(ADAUTIL_CFG_CLI)
+#include <ctype.h>
+#include <shell/shell.h>
+#include <console/console.h>
+#endif
+
 /*------------------------------------------------------------------*/
 /* MACRO TYPEDEF CONSTANT ENUM
  *------------------------------------------------------------------*/
+/* FNV-1a 32-bit */
+#define CFG_HASH_INIT     2166136261UL
+#define CFG_HASH_PRIME    16777619UL
+
+/* Index entry, sorted by name hash for binary search */
+typedef struct
+{
+  uint32_t hash;
+  const adacfg_info_t* var;
+  uint8_t id; ///< registration order, used for dirty bitmap
+} cfg_index_t;
+
+#define CFG_DIRTY_WORDS   ((CFG_ADACFG_MAXVAR + 31) / 32)
+
+#if MYNEWT_VAL(ADAUTIL_CFG_FCB)
+
+#define CFG_FCB_MAGIC         0x43414441UL // "ADAC"
+#define CFG_FCB_VERSION       1
+#define CFG_FCB_MAX_SECTORS   8
+
+/* Upper bound of the FCB sector header, entry length and CRC with padding */
+#define CFG_FCB_OVERHEAD      32
+
+/* Binary record, an FCB entry holds one or more of these back to back.
+ * Variables are identified by name hash, value bytes follow the header */
+typedef struct
+{
+  uint32_t hash;
+  uint8_t  type;
+  uint8_t  reserved;
+  uint16_t len;
+} cfg_record_t;
+
+VERIFY_STATIC(sizeof(cfg_record_t) == 8, "record header must not be padded");
+
+#endif
+
+/*------------------------------------------------------------------*/
+/* STATISTICS STRUCT DEFINITION
+ *------------------------------------------------------------------*/
+#if MYNEWT_VAL(ADAUTIL_CFG_STATS)
+
+/* Define the core stats structure */
+STATS_SECT_START(adacfg_stat_section)
+    STATS_SECT_ENTRY(saves)
+    STATS_SECT_ENTRY(save_fails)
+    STATS_SECT_ENTRY(flash_ops)
+    STATS_SECT_ENTRY(clean_skips)
+STATS_SECT_END
+
+/* Define the stat names for querying */
+STATS_NAME_START(adacfg_stat_section)
+    STATS_NAME(adacfg_stat_section, saves)
+    STATS_NAME(adacfg_stat_section, save_fails)
+    STATS_NAME(adacfg_stat_section, flash_ops)
+    STATS_NAME(adacfg_stat_section, clean_skips)
+STATS_NAME_END(adacfg_stat_section)
+
+STATS_SECT_DECL(adacfg_stat_section) g_adacfg_stats;
+
+#define _STATS_INC(x)     STATS_INC(g_adacfg_stats, x)
+
+#else
 
+#define _STATS_INC(x)
+
+#endif
 
 
 /*------------------------------------------------------------------*/
@@ -59,12 +140,53 @@ static char* cfg_get    (int argc, char **argv, char *val, int max_len);
 static int   cfg_set    (int argc, char **argv, char *val);
 static int   cfg_commit (void);
 static int   cfg_export (void (*export_func)(char *name, char *val), enum conf_export_tgt tgt);
+static int   var_add    (const adacfg_info_t* cfgvar);
+static uint8_t index_lower_bound(uint32_t hash);
+static void  notify_changes(void);
+
+/* Bounds of the compile-time schema section, provided by the linker.
+ * Weak so that they resolve to NULL when no ADACFG_xxx() is used */
+extern const adacfg_info_t __start_adacfg_schema[] ATTR_WEAK;
+extern const adacfg_info_t __stop_adacfg_schema[]  ATTR_WEAK;
+
+#if MYNEWT_VAL(ADAUTIL_CFG_FCB)
+static int cfg_fcb_init(void);
+static int cfg_fcb_load(void);
+static int cfg_fcb_save(void);
+#endif
+
+#if MYNEWT_VAL(ADAUTIL_CFG_CLI)
+static int cfg_cli_cmd(int argc, char **argv);
+
+static struct shell_cmd _cfg_cli = { .sc_cmd = "adacfg", .sc_cmd_func = cfg_cli_cmd };
+#endif
 
 static struct
 {
   struct conf_handler hdl;
-  uint8_t list_count;
-  const adacfg_info_t* varlist[CFG_ADACFG_MAXCONFIG];
+  /* Variables in registration order (by id), and sorted by hash */
+  uint8_t var_count;
+  const adacfg_info_t* vars[CFG_ADACFG_MAXVAR];
+  cfg_index_t index[CFG_ADACFG_MAXVAR];
+
+  bool loading;
+  uint32_t dirty[CFG_DIRTY_WORDS];
+
+  /* Snapshot of dirty bitmap being saved, and result of the save */
+  uint32_t saving[CFG_DIRTY_WORDS];
+  int save_rc;
+
+  adacfg_filter_t filter;
+
+  /* Set since last commit, and change listeners (not called while muted) */
+  uint32_t changed[CFG_DIRTY_WORDS];
+  SLIST_HEAD(, adacfg_listener) listeners;
+  bool mute;
+
+#if MYNEWT_VAL(ADAUTIL_CFG_FCB)
+  struct fcb fcb;
+  struct flash_area sectors[CFG_FCB_MAX_SECTORS];
+#endif
 } _adacfg =
 {
     .hdl = {
@@ -90,29 +212,177 @@ int adacfg_init(const char* prefix)
    * inside sysinit(). We only need to register handler */
 
   /*------------- Register config file -------------*/
-  _adacfg.list_count = 0;
+  _adacfg.var_count  = 0;
+  varclr(_adacfg.dirty);
+  varclr(_adacfg.changed);
   if (prefix) _adacfg.hdl.ch_name = (char*) prefix;
   VERIFY_STATUS( conf_register(&_adacfg.hdl) );
 
+  /*------------- Compile-time schema -------------*/
+  for(const adacfg_info_t* cfgvar = __start_adacfg_schema; cfgvar < __stop_adacfg_schema; cfgvar++)
+  {
+    VERIFY_STATUS( var_add(cfgvar) );
+  }
+
+#if MYNEWT_VAL(ADAUTIL_CFG_STATS)
+  /* Initialise the stats section */
+  stats_init( STATS_HDR(g_adacfg_stats),
+              STATS_SIZE_INIT_PARMS(g_adacfg_stats, STATS_SIZE_32),
+              STATS_NAME_INIT_PARMS(adacfg_stat_section));
+
+  /* Register the stats section */
+  stats_register("adacfg", STATS_HDR(g_adacfg_stats));
+#endif
+
+#if MYNEWT_VAL(ADAUTIL_CFG_FCB)
+  VERIFY_STATUS( cfg_fcb_init() );
+#endif
+
+#if MYNEWT_VAL(ADAUTIL_CFG_CLI)
+  (void) shell_cmd_register(&_cfg_cli);
+#endif
+
   return 0;
 }
 
 /**
- * Add an configure array
- * @param cfg
+ * Hash a string, continuing from a previous hash value
+ * @param hash
+ * @param str
  * @return
  */
+static uint32_t name_hash(uint32_t hash, char const* str)
+{
+  while ( *str )
+  {
+    hash ^= (uint8_t) (*str++);
+    hash *= CFG_HASH_PRIME;
+  }
+
+  return hash;
+}
+
+/**
+ * Hash var name in [argc, argv] format, same as hashing "argv[0]/argv[1]/..."
+ * @param argc
+ * @param argv
+ * @return
+ */
+static uint32_t argv_hash(int argc, char **argv)
+{
+  uint32_t hash = CFG_HASH_INIT;
+
+  for(int i=0; i<argc; i++)
+  {
+    if ( i ) hash = name_hash(hash, "/");
+    hash = name_hash(hash, argv[i]);
+  }
+
+  return hash;
+}
+
+/**
+ * Add a variable, insertion sorted into the index by hash
+ * @param cfgvar
+ * @return 0 if successful, OS_EINVAL if its name hash is already taken
+ *         with the FCB backend
+ */
+static int var_add(const adacfg_info_t* cfgvar)
+{
+  if ( _adacfg.var_count >= CFG_ADACFG_MAXVAR ) return -1;
+
+  uint32_t const hash = name_hash(CFG_HASH_INIT, cfgvar->name);
+
+#if MYNEWT_VAL(ADAUTIL_CFG_FCB)
+  /* Binary records only carry the hash, a collision would load one
+   * variable's value into the other */
+  uint8_t const same = index_lower_bound(hash);
+  if ( same < _adacfg.var_count && _adacfg.index[same].hash == hash )
+  {
+    ADALOG(ERROR, "adacfg: %s has the same hash as %s\n", cfgvar->name, _adacfg.index[same].var->name);
+    return OS_EINVAL;
+  }
+#endif
+
+  uint8_t pos = _adacfg.var_count;
+  while ( pos && _adacfg.index[pos-1].hash > hash )
+  {
+    _adacfg.index[pos] = _adacfg.index[pos-1];
+    pos--;
+  }
+
+  _adacfg.index[pos].hash = hash;
+  _adacfg.index[pos].var  = cfgvar;
+  _adacfg.index[pos].id   = _adacfg.var_count;
+
+  _adacfg.vars[_adacfg.var_count++] = cfgvar;
+
+  return 0;
+}
+
+/**
+ * Remove the variables added after the first count ones
+ * @param count
+ */
+static void var_truncate(uint8_t count)
+{
+  uint8_t n = 0;
+  for(uint8_t i=0; i<_adacfg.var_count; i++)
+  {
+    if ( _adacfg.index[i].id < count ) _adacfg.index[n++] = _adacfg.index[i];
+  }
+
+  _adacfg.var_count = count;
+}
+
+/**
+ * Add an configure array at runtime, variables declared with ADACFG_xxx()
+ * are already added by adacfg_init(). Values are not loaded from flash until
+ * adacfg_load() is called, so that all arrays are loaded in one pass.
+ * @param cfg
+ * @return 0 if successful, otherwise nothing of cfg is added
+ */
 int adacfg_add(const adacfg_info_t* cfg)
 {
-  if ( _adacfg.list_count >= CFG_ADACFG_MAXCONFIG ) return -1;
+  /* Check index capacity first so that a failure leaves nothing half-added */
+  uint8_t count = 0;
+  for(const adacfg_info_t* cfgvar = cfg; cfgvar->name; cfgvar++) count++;
 
-  _adacfg.varlist[_adacfg.list_count++] = cfg;
+  if ( _adacfg.var_count + count > CFG_ADACFG_MAXVAR ) return -1;
 
-  conf_load();
+  uint8_t const start = _adacfg.var_count;
+  for(const adacfg_info_t* cfgvar = cfg; cfgvar->name; cfgvar++)
+  {
+    int const rc = var_add(cfgvar);
+    if ( rc )
+    {
+      var_truncate(start);
+      return rc;
+    }
+  }
 
   return 0;
 }
 
+/**
+ * Load all added configure arrays from flash. Should be called once
+ * after all adacfg_add()
+ * @return
+ */
+int adacfg_load(void)
+{
+#if MYNEWT_VAL(ADAUTIL_CFG_FCB)
+  int rc = cfg_fcb_load();
+#else
+  /* Values read back from flash are not dirty */
+  _adacfg.loading = true;
+  int rc = conf_load();
+  _adacfg.loading = false;
+#endif
+
+  return rc;
+}
+
 /**
  * Helper to check if var name in [argc, argv] is equal to string array
  * @param name
@@ -136,7 +406,77 @@ static bool name_equal(char const * name, int argc, char **argv)
     }
   }
 
-  return true;
+  /* argv must cover the whole name */
+  return (*name == 0);
+}
+
+/**
+ * Binary search for the first index entry with hash not less than hash
+ * @param hash
+ * @return position in index, var_count if none
+ */
+static uint8_t index_lower_bound(uint32_t hash)
+{
+  uint8_t lo = 0, hi = _adacfg.var_count;
+  while ( lo < hi )
+  {
+    uint8_t const mid = (lo + hi) / 2;
+
+    if ( _adacfg.index[mid].hash < hash ) lo = mid + 1;
+    else hi = mid;
+  }
+
+  return lo;
+}
+
+/**
+ * Look up a variable by name in [argc, argv] format
+ * @param argc
+ * @param argv
+ * @return index entry, NULL if not found
+ */
+static const cfg_index_t* var_find(int argc, char **argv)
+{
+  uint32_t const hash = argv_hash(argc, argv);
+  uint8_t lo = index_lower_bound(hash);
+
+  /* Verify the name in case of hash collision */
+  for( ; lo < _adacfg.var_count && _adacfg.index[lo].hash == hash; lo++)
+  {
+    if ( name_equal(_adacfg.index[lo].var->name, argc, argv) ) return &_adacfg.index[lo];
+  }
+
+  return NULL;
+}
+
+static inline void bitmap_set(uint32_t* bitmap, uint8_t id)
+{
+  os_sr_t sr;
+  OS_ENTER_CRITICAL(sr);
+  bitmap[id / 32] |= (1UL << (id % 32));
+  OS_EXIT_CRITICAL(sr);
+}
+
+static inline bool bitmap_test(uint32_t const* bitmap, uint8_t id)
+{
+  return (bitmap[id / 32] & (1UL << (id % 32))) != 0;
+}
+
+/**
+ * Mark a variable as modified so that it is written by next adacfg_save().
+ * Should be called after changing a variable value in RAM.
+ * @param name variable name as in adacfg_info_t
+ * @return 0 if successful, OS_ENOENT if not found
+ */
+int adacfg_set_dirty(const char* name)
+{
+  /* [argc, argv] form with a single element, '/' is part of the name */
+  const cfg_index_t* entry = var_find(1, (char**) &name);
+  if ( entry == NULL ) return OS_ENOENT;
+
+  bitmap_set(_adacfg.dirty, entry->id);
+
+  return 0;
 }
 
 /**
@@ -148,66 +488,503 @@ static bool name_equal(char const * name, int argc, char **argv)
  */
 static int cfg_set (int argc, char **argv, char *val)
 {
-  for ( uint8_t i = 0; i < _adacfg.list_count; i++ )
-  {
-    const adacfg_info_t* cfgvar = _adacfg.varlist[i];
+  const cfg_index_t* entry = var_find(argc, argv);
+  if ( entry == NULL ) return OS_ENOENT;
+
+  const adacfg_info_t* cfgvar = entry->var;
+  VERIFY_STATUS( conf_value_from_str(val, cfgvar->type, cfgvar->value, cfgvar->len) );
+
+  /* Set from CLI/newtmgr rather than loaded from flash */
+  if ( !_adacfg.loading ) bitmap_set(_adacfg.dirty, entry->id);
+
+  /* Listeners are notified on commit, once for the whole transaction */
+  bitmap_set(_adacfg.changed, entry->id);
+
+  return 0;
+}
 
-    while ( cfgvar->name )
+/**
+ * Register a listener notified when matching variables are changed through
+ * config management: loaded by adacfg_load() or set by CLI/newtmgr.
+ * Changes are coalesced, the callback is invoked once per commit no matter
+ * how many matching variables were set, in the context of the task
+ * committing (e.g main on load, newtmgr on set).
+ * @param listener  caller allocated, must stay valid
+ * @return 0 if successful
+ */
+int adacfg_listen(adacfg_listener_t* listener)
+{
+  if ( listener == NULL || listener->cb == NULL ) return OS_EINVAL;
+
+  SLIST_INSERT_HEAD(&_adacfg.listeners, listener, next);
+
+  return 0;
+}
+
+/**
+ * Check if variable name is covered by listener: exact name, a group
+ * prefix ending with '/', or NULL for all variables
+ * @param listener
+ * @param name
+ * @return
+ */
+static bool listener_match(adacfg_listener_t const* listener, char const* name)
+{
+  if ( listener->name == NULL ) return true;
+
+  size_t const len = strlen(listener->name);
+  if ( len && listener->name[len-1] == '/' ) return 0 == strncmp(name, listener->name, len);
+
+  return 0 == strcmp(name, listener->name);
+}
+
+/**
+ * Invoke each listener once if any of its variables changed since last call
+ */
+static void notify_changes(void)
+{
+  uint32_t changed[CFG_DIRTY_WORDS];
+  os_sr_t sr;
+
+  OS_ENTER_CRITICAL(sr);
+  memcpy(changed, _adacfg.changed, sizeof(changed));
+  varclr(_adacfg.changed);
+  OS_EXIT_CRITICAL(sr);
+
+  if ( _adacfg.mute ) return;
+
+  adacfg_listener_t* listener;
+  SLIST_FOREACH(listener, &_adacfg.listeners, next)
+  {
+    for(uint8_t id=0; id<_adacfg.var_count; id++)
     {
-      if ( name_equal(cfgvar->name, argc, argv) )
+      if ( bitmap_test(changed, id) && listener_match(listener, _adacfg.vars[id]->name) )
       {
-        return conf_value_from_str(val, cfgvar->type, cfgvar->value, cfgvar->len);
+        listener->cb(listener->arg);
+        break;
       }
+    }
+  }
+}
+
+/**
+ * Callback from config management at the end of a transaction
+ * (after conf_load() or conf_commit())
+ * @return
+ */
+static int cfg_commit (void)
+{
+  notify_changes();
+  return 0;
+}
+
+/**
+ * Set a filter deciding which variables are exported, e.g to keep a
+ * variable out of the CLI/newtmgr listing or never persist it
+ * @param filter  return false to skip a variable, NULL to export all
+ */
+void adacfg_set_export_filter(adacfg_filter_t filter)
+{
+  _adacfg.filter = filter;
+}
+
+static inline bool export_allowed(const adacfg_info_t* var, enum conf_export_tgt tgt)
+{
+  return (_adacfg.filter == NULL) || _adacfg.filter(var, tgt);
+}
+
+/**
+ * Export variables in registration order. Names and values are built in
+ * stack buffers, nothing is allocated.
+ * @param func      export callback
+ * @param tgt       export target, passed to the export filter
+ * @param only_set  if not NULL, only variables whose bit is set are exported
+ */
+static void export_vars (void (*func) (char *name, char *val), enum conf_export_tgt tgt, uint32_t const* only_set)
+{
+  char valbuf[CONF_MAX_VAL_LEN+1];
+  char fullname[CONF_MAX_NAME_LEN];
+
+  /* "prefix/" is written once, only the variable name changes */
+  size_t const prefix_len = strlen(_adacfg.hdl.ch_name);
+  if ( prefix_len + 2 > sizeof(fullname) ) return;
+
+  memcpy(fullname, _adacfg.hdl.ch_name, prefix_len);
+  fullname[prefix_len] = '/';
 
-      cfgvar++;
+  char* const varname = fullname + prefix_len + 1;
+  size_t const varname_max = sizeof(fullname) - prefix_len - 1;
+
+  for ( uint8_t id = 0; id < _adacfg.var_count; id++ )
+  {
+    const adacfg_info_t* cfgvar = _adacfg.vars[id];
+
+    if ( only_set && !bitmap_test(only_set, id) )
+    {
+      _STATS_INC(clean_skips);
+      continue;
     }
+
+    if ( !export_allowed(cfgvar, tgt) ) continue;
+
+    /* Skip rather than truncate name, NULL value would mean delete */
+    size_t const len = strlen(cfgvar->name);
+    if ( len >= varname_max ) continue;
+
+    char* value = conf_str_from_value(cfgvar->type, cfgvar->value, valbuf, sizeof(valbuf));
+    if ( value == NULL ) continue;
+
+    memcpy(varname, cfgvar->name, len+1);
+    func(fullname, value);
   }
+}
+
+/**
+ * Take a snapshot of dirty bitmap to be saved
+ * @return true if there is anything to save
+ */
+static bool saving_begin(void)
+{
+  bool any = false;
+  os_sr_t sr;
+
+  OS_ENTER_CRITICAL(sr);
+  for(uint8_t i=0; i<CFG_DIRTY_WORDS; i++)
+  {
+    _adacfg.saving[i] = _adacfg.dirty[i];
+    any = any || _adacfg.dirty[i];
+  }
+  OS_EXIT_CRITICAL(sr);
+
+  return any;
+}
+
+/**
+ * Clear dirty bits that have been saved. Variables marked dirty again
+ * while saving are kept dirty.
+ */
+static void saving_end(void)
+{
+  os_sr_t sr;
+
+  OS_ENTER_CRITICAL(sr);
+  for(uint8_t i=0; i<CFG_DIRTY_WORDS; i++) _adacfg.dirty[i] &= ~_adacfg.saving[i];
+  OS_EXIT_CRITICAL(sr);
+}
+
+/**
+ * Export callback used by adacfg_save() to write one variable to flash
+ * @param name
+ * @param val
+ */
+static void save_one(char *name, char *val)
+{
+  _STATS_INC(flash_ops);
 
-  return OS_ENOENT;
+  int rc = conf_save_one(name, val);
+  if ( _adacfg.save_rc == 0 ) _adacfg.save_rc = rc;
 }
 
+/*------------------------------------------------------------------*/
+/* BINARY FCB BACKEND
+ *------------------------------------------------------------------*/
+#if MYNEWT_VAL(ADAUTIL_CFG_FCB)
+
 /**
- * Callback from config management when data is written to Flash
+ * Size of variable value as stored in a binary record
+ * @param var
  * @return
  */
-static int cfg_commit (void)
+static uint16_t value_size(const adacfg_info_t* var)
+{
+  switch ( var->type )
+  {
+    case CONF_INT8:
+    case CONF_BOOL:   return 1;
+    case CONF_INT16:  return 2;
+    case CONF_INT32:
+    case CONF_FLOAT:  return 4;
+    case CONF_INT64:
+    case CONF_DOUBLE: return 8;
+
+    /* Including null terminator */
+    case CONF_STRING: return var->len ? strnlen((char const*) var->value, var->len-1) + 1 : 0;
+    case CONF_BYTES:  return var->len;
+
+    default:          return 0;
+  }
+}
+
+/**
+ * Find the variable a record belongs to
+ * @param rec
+ * @return index entry, NULL if unknown or its type/size does not match anymore
+ */
+static const cfg_index_t* record_find(cfg_record_t const* rec)
+{
+  uint8_t const pos = index_lower_bound(rec->hash);
+  if ( pos >= _adacfg.var_count || _adacfg.index[pos].hash != rec->hash ) return NULL;
+
+  const adacfg_info_t* var = _adacfg.index[pos].var;
+  if ( var->type != rec->type ) return NULL;
+
+  if ( var->type == CONF_STRING )
+  {
+    if ( rec->len == 0 || rec->len > var->len ) return NULL;
+  }
+  else if ( rec->len != value_size(var) )
+  {
+    return NULL;
+  }
+
+  return &_adacfg.index[pos];
+}
+
+/**
+ * fcb_walk() callback, copy all records of an entry to their variables.
+ * Entries are walked oldest first, so the latest value wins.
+ * @param loc
+ * @param arg
+ * @return
+ */
+static int fcb_load_entry(struct fcb_entry *loc, void *arg)
 {
-  /*not used for now*/
+  (void) arg;
+
+  uint16_t offset = 0;
+  while ( offset + sizeof(cfg_record_t) <= loc->fe_data_len )
+  {
+    cfg_record_t rec;
+    if ( flash_area_read(loc->fe_area, loc->fe_data_off + offset, &rec, sizeof(rec)) ) break;
+    offset += sizeof(rec);
+
+    if ( offset + rec.len > loc->fe_data_len ) break;
+
+    const cfg_index_t* entry = record_find(&rec);
+    if ( entry && 0 == flash_area_read(loc->fe_area, loc->fe_data_off + offset, entry->var->value, rec.len) )
+    {
+      if ( entry->var->type == CONF_STRING ) ((char*) entry->var->value)[rec.len-1] = 0;
+      bitmap_set(_adacfg.changed, entry->id);
+    }
+
+    offset += rec.len;
+  }
+
   return 0;
 }
 
 /**
- * Callback from config management to store all local variables to flash
- * @param func
- * @param tgt
+ * Load all variables from FCB. Values are copied straight from flash,
+ * no string parsing is involved.
  * @return
  */
-static int cfg_export (void (*func) (char *name, char *val), enum conf_export_tgt tgt)
+static int cfg_fcb_load(void)
+{
+  int rc = fcb_walk(&_adacfg.fcb, NULL, fcb_load_entry, NULL);
+
+  /* No conf_commit() on this path */
+  notify_changes();
+
+  return rc;
+}
+
+/**
+ * Size of the FCB entry holding the variables in saving bitmap
+ * @return
+ */
+static uint32_t cfg_fcb_entry_size(void)
 {
-  char* tempbuf  = malloc(CONF_MAX_VAL_LEN+1);
-  char* fullname = malloc(CONF_MAX_NAME_LEN);
+  uint32_t total = 0;
+  for(uint8_t i=0; i<_adacfg.var_count; i++)
+  {
+    if ( bitmap_test(_adacfg.saving, _adacfg.index[i].id) &&
+         export_allowed(_adacfg.index[i].var, CONF_EXPORT_PERSIST) )
+    {
+      total += sizeof(cfg_record_t) + value_size(_adacfg.index[i].var);
+    }
+  }
 
-  strcpy(fullname, _adacfg.hdl.ch_name);
+  return total;
+}
 
-  char* varname = fullname + strlen(fullname);
-  *varname++ = '/';
+/**
+ * Append one FCB entry with a record for each variable in saving bitmap.
+ * The entry is only valid (CRC written) once all records are written,
+ * so a batch is either loaded completely or not at all.
+ * @return 0 if successful, FCB_ERR_NOSPACE if a sector rotation is needed
+ */
+static int cfg_fcb_write(void)
+{
+  uint32_t const total = cfg_fcb_entry_size();
+  if ( total > UINT16_MAX ) return FCB_ERR_ARGS;
+
+  struct fcb_entry loc;
+  VERIFY_STATUS( fcb_append(&_adacfg.fcb, (uint16_t) total, &loc) );
 
-  for ( uint8_t i = 0; i < _adacfg.list_count; i++ )
+  uint16_t offset = 0;
+  for(uint8_t i=0; i<_adacfg.var_count; i++)
   {
-    const adacfg_info_t* cfgvar = _adacfg.varlist[i];
-    while ( cfgvar->name )
+    const cfg_index_t* entry = &_adacfg.index[i];
+    if ( !bitmap_test(_adacfg.saving, entry->id) ) continue;
+    if ( !export_allowed(entry->var, CONF_EXPORT_PERSIST) ) continue;
+
+    cfg_record_t const rec =
     {
-      char* value = conf_str_from_value(cfgvar->type, cfgvar->value, tempbuf, sizeof(tempbuf));
+      .hash = entry->hash,
+      .type = entry->var->type,
+      .len  = value_size(entry->var)
+    };
 
-      strcpy(varname, cfgvar->name);
-      func(fullname, value);
+    _STATS_INC(flash_ops);
+    VERIFY_STATUS( flash_area_write(loc.fe_area, loc.fe_data_off + offset, &rec, sizeof(rec)) );
+    offset += sizeof(rec);
 
-      cfgvar++;
+    if ( rec.len )
+    {
+      _STATS_INC(flash_ops);
+      VERIFY_STATUS( flash_area_write(loc.fe_area, loc.fe_data_off + offset, entry->var->value, rec.len) );
+      offset += rec.len;
     }
   }
 
-  free(tempbuf);
-  free(fullname);
+  return fcb_append_finish(&_adacfg.fcb, &loc);
+}
+
+/**
+ * Save modified variables (saving bitmap) to FCB.
+ *
+ * When the FCB is full, as conf_fcb does when compressing, live values are
+ * written forward before the oldest sector is erased: the scratch sector is
+ * taken into use and a snapshot of every variable written there, then the
+ * oldest sector is rotated out. A reset at any point leaves every value in
+ * flash. The snapshot includes the variables being saved, so one rotation
+ * is always enough.
+ *
+ * Only a snapshot uses up the scratch sector, finding none means that the
+ * previous save stopped (reset or error) before rotating. That snapshot
+ * already supersedes the oldest sector, which is then rotated out first.
+ * @return 0 if successful, FCB_ERR_NOSPACE if a snapshot does not fit in
+ *         one sector (nothing is erased then)
+ */
+static int cfg_fcb_save(void)
+{
+  int rc = cfg_fcb_write();
+  if ( rc != FCB_ERR_NOSPACE ) return rc;
+
+  os_sr_t sr;
+  OS_ENTER_CRITICAL(sr);
+  for(uint8_t id=0; id<_adacfg.var_count; id++) _adacfg.saving[id / 32] |= (1UL << (id % 32));
+  OS_EXIT_CRITICAL(sr);
+
+  /* Check before using up the scratch sector, which could not be released
+   * by rotation if the snapshot failed */
+  uint32_t const need = cfg_fcb_entry_size() + CFG_FCB_OVERHEAD;
+  for(uint8_t i=0; i<_adacfg.fcb.f_sector_cnt; i++)
+  {
+    if ( _adacfg.sectors[i].fa_size < need ) return FCB_ERR_NOSPACE;
+  }
+
+  rc = fcb_append_to_scratch(&_adacfg.fcb);
+  if ( rc == FCB_ERR_NOSPACE )
+  {
+    VERIFY_STATUS( fcb_rotate(&_adacfg.fcb) );
+    rc = fcb_append_to_scratch(&_adacfg.fcb);
+  }
+  VERIFY_STATUS( rc );
+
+  VERIFY_STATUS( cfg_fcb_write() );
+
+  return fcb_rotate(&_adacfg.fcb);
+}
+
+/**
+ * Set up FCB on its flash area, the area is erased if it does not hold
+ * a valid FCB (first boot or format change)
+ * @return
+ */
+static int cfg_fcb_init(void)
+{
+  int const area_id = MYNEWT_VAL(ADAUTIL_CFG_FCB_AREA);
+  int cnt;
+
+  VERIFY_STATUS( flash_area_to_sectors(area_id, &cnt, NULL) );
+
+  /* At least one sector in use and one scratch */
+  if ( cnt < 2 || cnt > CFG_FCB_MAX_SECTORS ) return OS_EINVAL;
+
+  VERIFY_STATUS( flash_area_to_sectors(area_id, &cnt, _adacfg.sectors) );
+
+  struct fcb* fcb = &_adacfg.fcb;
+  fcb->f_magic       = CFG_FCB_MAGIC;
+  fcb->f_version     = CFG_FCB_VERSION;
+  fcb->f_sector_cnt  = cnt;
+  fcb->f_scratch_cnt = 1;
+  fcb->f_sectors     = _adacfg.sectors;
+
+  if ( fcb_init(fcb) )
+  {
+    for(int i=0; i<cnt; i++)
+    {
+      flash_area_erase(&_adacfg.sectors[i], 0, _adacfg.sectors[i].fa_size);
+    }
+
+    VERIFY_STATUS( fcb_init(fcb) );
+  }
+
+  return 0;
+}
+
+#endif // ADAUTIL_CFG_FCB
+
+/**
+ * Write all modified variables to flash as one batch. Dirty flags are only
+ * cleared if the whole batch succeeded, otherwise the same batch is written
+ * again by next save (writing a value already in flash is a no-op).
+ * @return 0 if successful
+ */
+int adacfg_save(void)
+{
+  if ( !saving_begin() ) return 0;
+
+  _STATS_INC(saves);
+
+#if MYNEWT_VAL(ADAUTIL_CFG_FCB)
+  _adacfg.save_rc = cfg_fcb_save();
+#else
+  _adacfg.save_rc = 0;
+  export_vars(save_one, CONF_EXPORT_PERSIST, _adacfg.saving);
+#endif
+
+  if ( _adacfg.save_rc )
+  {
+    _STATS_INC(save_fails);
+    return _adacfg.save_rc;
+  }
+
+  saving_end();
+
+  return 0;
+}
+
+/**
+ * Callback from config management to store local variables to flash.
+ * When persisting (e.g conf_save()) only modified variables are written,
+ * through adacfg_save() rather than func: func reports no error, and dirty
+ * flags must stay set if a write fails.
+ * @param func
+ * @param tgt
+ * @return
+ */
+static int cfg_export (void (*func) (char *name, char *val), enum conf_export_tgt tgt)
+{
+  if ( tgt == CONF_EXPORT_PERSIST )
+  {
+    return adacfg_save();
+  }
+  else
+  {
+    export_vars(func, CONF_EXPORT_SHOW, NULL);
+  }
 
   return 0;
 }
@@ -222,23 +999,141 @@ static int cfg_export (void (*func) (char *name, char *val), enum conf_export_tg
  */
 static char* cfg_get (int argc, char **argv, char *buf, int max_len)
 {
-  for ( uint8_t i = 0; i < _adacfg.list_count; i++ )
+  const cfg_index_t* entry = var_find(argc, argv);
+  if ( entry == NULL ) return NULL;
+
+  return conf_str_from_value(entry->var->type, entry->var->value, buf, max_len);
+}
+
+/*------------------------------------------------------------------*/
+/* CLI
+ *------------------------------------------------------------------*/
+#if MYNEWT_VAL(ADAUTIL_CFG_CLI)
+
+/**
+ * Change a variable so that the next save really writes it: the text
+ * backend skips values equal to the stored ones. Applied twice the value
+ * is back to the original.
+ * @param var
+ * @return true if the value was changed
+ */
+static bool bench_toggle(const adacfg_info_t* var)
+{
+  uint8_t* value = (uint8_t*) var->value;
+
+  switch ( var->type )
   {
-    const adacfg_info_t* cfgvar = _adacfg.varlist[i];
+    case CONF_INT8:
+    case CONF_BOOL:
+    case CONF_INT16:
+    case CONF_INT32:
+    case CONF_INT64:
+      value[0] ^= 1;
+      return true;
 
-    while ( cfgvar->name )
-    {
-      if ( name_equal(cfgvar->name, argc, argv) )
-      {
-        return conf_str_from_value(cfgvar->type, cfgvar->value, buf, max_len);
-      }
+    case CONF_BYTES:
+      if ( var->len == 0 ) return false;
+      value[0] ^= 1;
+      return true;
 
-      cfgvar++;
+    /* Swap case of the first letter, same length and still printable */
+    case CONF_STRING:
+      if ( !isalpha(value[0]) ) return false;
+      value[0] ^= 0x20;
+      return true;
+
+    default: return false;
+  }
+}
+
+/**
+ * Toggle all variables, the changed ones are marked dirty. Both backends
+ * then write exactly those.
+ * @return number of variables changed
+ */
+static uint8_t bench_toggle_all(void)
+{
+  uint8_t changed = 0;
+
+  for(uint8_t id=0; id<_adacfg.var_count; id++)
+  {
+    if ( bench_toggle(_adacfg.vars[id]) )
+    {
+      bitmap_set(_adacfg.dirty, id);
+      changed++;
     }
   }
 
-  return NULL;
+  return changed;
 }
 
+/**
+ * 'adacfg bench [count]' : time full save and load cycles of all variables,
+ * to compare storage backends e.g on native BSP simulated flash.
+ * Values are changed before each save so that both backends write the
+ * same variables, their count is reported. The count is rounded up to even,
+ * values end as they were. Change listeners are not called meanwhile.
+ * @param argc
+ * @param argv
+ * @return
+ */
+static int cfg_cli_cmd(int argc, char **argv)
+{
+  if ( argc < 2 || strcmp(argv[1], "bench") )
+  {
+    console_printf("usage: adacfg bench [count]\n");
+    return 0;
+  }
+
+  uint32_t count = (argc > 2) ? strtoul(argv[2], NULL, 0) : 10;
+  count = (count + 1) & ~1UL;
+  if ( count == 0 ) count = 2;
+
+  uint32_t save_us = 0;
+  uint32_t load_us = 0;
+  uint32_t toggles = 0;
+  uint8_t  changed = 0;
+  uint32_t i;
+  int rc = 0;
+
+  _adacfg.mute = true;
+
+  for(i=0; i<count && rc == 0; i++)
+  {
+    changed = bench_toggle_all();
+    toggles++;
+
+    uint32_t start = os_cputime_get32();
+    rc = adacfg_save();
+    save_us += os_cputime_ticks_to_usecs(os_cputime_get32() - start);
+
+    if ( rc ) break;
+
+    start = os_cputime_get32();
+    rc = adacfg_load();
+    load_us += os_cputime_ticks_to_usecs(os_cputime_get32() - start);
+  }
+
+  /* Stopped by an error: restore the values, saved when possible */
+  if ( toggles & 1 )
+  {
+    bench_toggle_all();
+    (void) adacfg_save();
+  }
+
+  _adacfg.mute = false;
+
+  if ( i == 0 ) i = 1;
+
+  console_printf("%s: %u vars, %u written per save, save %lu us, load %lu us (avg of %lu), rc %d\n",
+                 MYNEWT_VAL(ADAUTIL_CFG_FCB) ? "fcb" : "nffs", _adacfg.var_count, changed,
+                 (unsigned long) (save_us/i), (unsigned long) (load_us/i),
+                 (unsigned long) i, rc);
+
+  return 0;
+}
+
+#endif // ADAUTIL_CFG_CLI
+
 
 #endif
@@ -0,0 +1,155 @@
+/**************************************************************************/
+/*!
+    @file     ada_gatt.c
+    @author   hathach
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2016, Adafruit Industries (adafruit.com)
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/**************************************************************************/
+
+#include "adafruit/adautil.h"
+
+#if MYNEWT_VAL(ADAUTIL_GATT)
+
+#include "adafruit/ada_gatt.h"
+
+/*------------------------------------------------------------------*/
+/* FUNCTION DECLARATION
+ *------------------------------------------------------------------*/
+
+/**
+ * Single access callback of all adagatt services. The characteristic is
+ * found by its position in the service table, no uuid lookup.
+ * @param conn_hdl
+ * @param attr_hdl
+ * @param ctxt
+ * @param arg   adagatt_svc_t
+ * @return 0 or BLE_ATT_ERR_xxx
+ */
+static int adagatt_access_cb(uint16_t conn_hdl, uint16_t attr_hdl, struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+  (void) attr_hdl;
+
+  adagatt_svc_t const* svc = (adagatt_svc_t const*) arg;
+  uint8_t const idx = ctxt->chr - svc->chr_def;
+  adagatt_chr_t const* chr = &svc->chars[idx];
+
+#if MYNEWT_VAL(ADAUTIL_GATT_STATS)
+  ((uint32_t*) (svc->stats+1))[idx]++;
+#endif
+
+  switch ( ctxt->op )
+  {
+    case BLE_GATT_ACCESS_OP_READ_CHR:
+    {
+      if ( chr->value == NULL ) return BLE_ATT_ERR_READ_NOT_PERMITTED;
+
+      uint16_t const len = chr->len ? *chr->len : chr->max_len;
+      return os_mbuf_append(ctxt->om, chr->value, len) ? BLE_ATT_ERR_INSUFFICIENT_RES : 0;
+    }
+
+    case BLE_GATT_ACCESS_OP_WRITE_CHR:
+    {
+      if ( chr->value )
+      {
+        uint16_t const pktlen = OS_MBUF_PKTLEN(ctxt->om);
+
+        /* Fixed length value must be written as a whole */
+        if ( (pktlen > chr->max_len) || (chr->len == NULL && pktlen != chr->max_len) )
+        {
+          return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        }
+
+        uint16_t len;
+        VERIFY_STATUS( ble_hs_mbuf_to_flat(ctxt->om, chr->value, chr->max_len, &len), BLE_ATT_ERR_UNLIKELY );
+
+        if ( chr->len ) *chr->len = len;
+      }
+
+      if ( chr->on_write ) chr->on_write(conn_hdl, ctxt->om);
+
+      return 0;
+    }
+
+    default: return BLE_ATT_ERR_UNLIKELY;
+  }
+}
+
+/**
+ * Build the NimBLE tables of a service and add it to the GATT server.
+ * Must be called before the host is started, e.g in the library init.
+ * @param svc   declared with ADAGATT_SERVICE_DEF()
+ * @return 0 if successful, otherwise BLE_HS_Exxx
+ */
+int adagatt_register(adagatt_svc_t* svc)
+{
+  for(uint8_t i=0; i<svc->count; i++)
+  {
+    adagatt_chr_t const* chr = &svc->chars[i];
+
+    svc->chr_def[i] = (struct ble_gatt_chr_def)
+    {
+      .uuid       = chr->uuid,
+      .access_cb  = adagatt_access_cb,
+      .arg        = svc,
+      .flags      = chr->flags,
+      .val_handle = chr->val_handle,
+    };
+
+#if MYNEWT_VAL(ADAUTIL_GATT_STATS)
+    svc->stat_names[i] = (struct stats_name_map)
+    {
+      .snm_off  = sizeof(struct stats_hdr) + i*sizeof(uint32_t),
+      .snm_name = (char*) chr->name
+    };
+#endif
+  }
+  varclr(svc->chr_def[svc->count]);
+
+  svc->svc_def[0] = (struct ble_gatt_svc_def)
+  {
+    .type            = BLE_GATT_SVC_TYPE_PRIMARY,
+    .uuid            = svc->uuid,
+    .characteristics = svc->chr_def
+  };
+  varclr(svc->svc_def[1]);
+
+#if MYNEWT_VAL(ADAUTIL_GATT_STATS)
+  VERIFY_STATUS( stats_init(svc->stats, STATS_SIZE_32, svc->count, svc->stat_names, svc->count) );
+  VERIFY_STATUS( stats_register(svc->name, svc->stats) );
+#endif
+
+  VERIFY_STATUS( ble_gatts_count_cfg(svc->svc_def) );
+  VERIFY_STATUS( ble_gatts_add_svcs(svc->svc_def) );
+
+  return 0;
+}
+
+#endif
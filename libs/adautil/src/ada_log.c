@@ -36,9 +36,61 @@
 
 #include "adafruit/adautil.h"
 
+#if MYNEWT_VAL(ADAUTIL_LOG_ASYNC) || MYNEWT_VAL(ADAUTIL_LOG_BINARY)
+#include <console/console.h>
+#endif
+
 //--------------------------------------------------------------------+
 // MACRO CONSTANT TYPEDEF
 //--------------------------------------------------------------------+
+#define LOG_RING_SIZE   MYNEWT_VAL(ADAUTIL_LOG_RING_SIZE)
+
+VERIFY_STATIC((LOG_RING_SIZE & (LOG_RING_SIZE-1)) == 0 && LOG_RING_SIZE <= 32768, "ring size must be power of 2");
+
+/* Byte ring with free running indexes, records are written and read whole
+ * within a short critical section so producers can be tasks or ISRs */
+typedef struct
+{
+  uint8_t* buf;
+  uint16_t mask;
+  uint16_t head; // written by producers
+  uint16_t tail; // read by drain
+  uint32_t dropped;
+} log_ring_t;
+
+#if MYNEWT_VAL(ADAUTIL_LOG_ASYNC)
+
+/* Text record in the async ring, followed by len bytes of message */
+typedef struct
+{
+  uint16_t len;
+  uint8_t  module;
+  uint8_t  level;
+  uint32_t ts;
+} async_rec_t;
+
+#define ASYNC_STACK_SIZE  OS_STACK_ALIGN(MYNEWT_VAL(ADAUTIL_LOG_ASYNC_STACK_SIZE))
+
+/* Longest line formatted by the drain task, longer messages are truncated */
+#define ASYNC_LINE_MAX    128
+
+#endif
+
+#if MYNEWT_VAL(ADAUTIL_LOG_CRASH)
+
+#define CRASH_SIZE    MYNEWT_VAL(ADAUTIL_LOG_CRASH_SIZE)
+#define CRASH_MAGIC   0xADA1C0DEUL
+
+/* Flag in the length of an entry holding a raw binary record (record and
+ * arguments) instead of log_entry_hdr + message */
+#define CRASH_BIN     0x8000
+
+/* Longest message formatted from a binary record at recovery */
+#define CRASH_LINE_MAX  128
+
+VERIFY_STATIC((CRASH_SIZE & (CRASH_SIZE-1)) == 0 && CRASH_SIZE <= 32768, "crash ring size must be power of 2");
+
+#endif
 
 //--------------------------------------------------------------------+
 // VARIABLE DECLARATION
@@ -46,6 +98,192 @@
 static bool _initalized = false;
 struct log adalog;
 
+#if MYNEWT_VAL(ADAUTIL_LOG_CRASH)
+
+/* Entries of previous boot, exposed as a log for newtmgr */
+struct log adalog_crash;
+
+static int crash_read (struct log* log, void* dptr, void* buf, uint16_t offset, uint16_t len);
+static int crash_append(struct log* log, void* buf, int len);
+static int crash_walk (struct log* log, log_walk_func_t walk_func, struct log_offset* log_offset);
+static int crash_flush(struct log* log);
+
+static void crash_recover(void);
+static void crash_put(void const* entry, uint16_t len);
+static void crash_write(uint16_t flag, void const* hdr, uint16_t hdr_len, void const* data, uint16_t data_len);
+
+static const struct log_handler _crash_handler =
+{
+    .log_type   = LOG_TYPE_MEMORY,
+    .log_read   = crash_read,
+    .log_append = crash_append,
+    .log_walk   = crash_walk,
+    .log_flush  = crash_flush,
+};
+
+#if !MYNEWT_VAL(ADAUTIL_LOG_ASYNC)
+static int crash_tee_append(struct log* log, void* buf, int len);
+
+/* adalog handler: crash ring then console */
+static const struct log_handler _crash_tee_handler =
+{
+    .log_type   = LOG_TYPE_STREAM,
+    .log_append = crash_tee_append,
+};
+#endif
+
+/* Not cleared on reset. Log entries (log_entry_hdr + message) or binary
+ * records each preceded by 16-bit length, oldest entries are overwritten */
+static struct
+{
+  uint32_t magic;
+  uint16_t head;
+  uint16_t tail;
+  uint32_t check;
+  uint32_t fmt_id;  ///< format strings of the image writing binary records
+  uint8_t  buf[CRASH_SIZE];
+} _crash __attribute__ ((section(MYNEWT_VAL(ADAUTIL_LOG_CRASH_SECTION))));
+
+/* Linear copy of the ring recovered at boot */
+static uint8_t  _crash_prev[CRASH_SIZE];
+static uint16_t _crash_prev_len;
+
+#endif
+
+#if MYNEWT_VAL(ADAUTIL_LOG_BINARY)
+
+/* Format strings, provided by the linker */
+extern const char __start_adalog_fmt[] ATTR_WEAK;
+extern const char __stop_adalog_fmt[]  ATTR_WEAK;
+
+static void adalog_bin_drain(struct os_event* ev);
+
+static uint8_t _bin_buf[LOG_RING_SIZE];
+
+static struct
+{
+  log_ring_t ring;
+  struct os_event ev;
+} _bin =
+{
+    .ring = { .buf = _bin_buf, .mask = LOG_RING_SIZE-1 },
+    .ev   = { .ev_cb = adalog_bin_drain }
+};
+
+#endif
+
+#if MYNEWT_VAL(ADAUTIL_LOG_ASYNC)
+
+static int  async_append(struct log* log, void* buf, int len);
+static void async_drain(struct os_event* ev);
+static void adalog_async_task(void* arg);
+static void console_sink_write(const char* line, uint16_t len, void* arg);
+
+static const struct log_handler _async_handler =
+{
+    .log_type   = LOG_TYPE_STREAM,
+    .log_append = async_append,
+};
+
+static uint8_t _async_buf[LOG_RING_SIZE];
+static os_stack_t _async_stack[ASYNC_STACK_SIZE];
+
+static adalog_sink_t _console_sink = { .write = console_sink_write };
+
+static struct
+{
+  log_ring_t ring;
+
+  struct os_task task;
+  struct os_eventq evq;
+  struct os_event ev;
+
+  uint32_t dropped_reported;
+  SLIST_HEAD(, adalog_sink) sinks;
+} _async =
+{
+    .ring = { .buf = _async_buf, .mask = LOG_RING_SIZE-1 },
+    .ev   = { .ev_cb = async_drain }
+};
+
+#endif
+
+//--------------------------------------------------------------------+
+// Ring
+//--------------------------------------------------------------------+
+#if MYNEWT_VAL(ADAUTIL_LOG_BINARY) || MYNEWT_VAL(ADAUTIL_LOG_ASYNC)
+
+static void ring_copy_in(log_ring_t* ring, uint16_t pos, void const* data, uint16_t len)
+{
+  uint8_t const* src = (uint8_t const*) data;
+  while ( len-- ) ring->buf[(pos++) & ring->mask] = *src++;
+}
+
+static void ring_copy_out(log_ring_t const* ring, uint16_t pos, void* data, uint16_t len)
+{
+  uint8_t* dst = (uint8_t*) data;
+  while ( len-- ) *dst++ = ring->buf[(pos++) & ring->mask];
+}
+
+/**
+ * Write a record made of header and payload, all or nothing
+ * @return false if ring is full, record is dropped and counted
+ */
+static bool ring_write(log_ring_t* ring, void const* hdr, uint16_t hdr_len, void const* data, uint16_t data_len)
+{
+  uint16_t const len = hdr_len + data_len;
+
+  os_sr_t sr;
+  OS_ENTER_CRITICAL(sr);
+
+  if ( (uint16_t) (ring->mask + 1 - (uint16_t) (ring->head - ring->tail)) < len )
+  {
+    ring->dropped++;
+    OS_EXIT_CRITICAL(sr);
+    return false;
+  }
+
+  ring_copy_in(ring, ring->head, hdr, hdr_len);
+  ring_copy_in(ring, ring->head + hdr_len, data, data_len);
+  ring->head += len;
+
+  OS_EXIT_CRITICAL(sr);
+
+  return true;
+}
+
+/**
+ * Read the oldest record, payload size is given by payload_len() of header.
+ * Payload longer than data_max is truncated.
+ * @return payload length copied, -1 if ring is empty
+ */
+static int ring_read(log_ring_t* ring, void* hdr, uint16_t hdr_len, uint16_t (*payload_len)(void const* hdr),
+                     void* data, uint16_t data_max)
+{
+  os_sr_t sr;
+  OS_ENTER_CRITICAL(sr);
+
+  if ( ring->head == ring->tail )
+  {
+    OS_EXIT_CRITICAL(sr);
+    return -1;
+  }
+
+  ring_copy_out(ring, ring->tail, hdr, hdr_len);
+
+  uint16_t const len = payload_len(hdr);
+  uint16_t const count = min16(len, data_max);
+
+  ring_copy_out(ring, ring->tail + hdr_len, data, count);
+  ring->tail += hdr_len + len;
+
+  OS_EXIT_CRITICAL(sr);
+
+  return count;
+}
+
+#endif
+
 //--------------------------------------------------------------------+
 // FUNCTION DECLARATION
 //--------------------------------------------------------------------+
@@ -54,7 +292,579 @@ void adalog_init(void)
 {
   if (_initalized) return;
 
+#if MYNEWT_VAL(ADAUTIL_LOG_CRASH)
+  crash_recover();
+  log_register("adalog_crash", &adalog_crash, &_crash_handler, NULL, LOG_SYSLEVEL);
+#endif
+
+#if MYNEWT_VAL(ADAUTIL_LOG_ASYNC)
+  SLIST_INSERT_HEAD(&_async.sinks, &_console_sink, next);
+
+  os_eventq_init(&_async.evq);
+  os_task_init(&_async.task, "adalog", adalog_async_task, NULL, MYNEWT_VAL(ADAUTIL_LOG_ASYNC_PRIO),
+               OS_WAIT_FOREVER, _async_stack, ASYNC_STACK_SIZE);
+
+  log_register("adalog", &adalog, &_async_handler, NULL, LOG_SYSLEVEL);
+#elif MYNEWT_VAL(ADAUTIL_LOG_CRASH)
+  log_register("adalog", &adalog, &_crash_tee_handler, NULL, LOG_SYSLEVEL);
+#else
   log_register("adalog", &adalog, &log_console_handler, NULL, LOG_SYSLEVEL);
+#endif
 
   _initalized = true;
 }
+
+#if MYNEWT_VAL(ADAUTIL_LOG_BINARY)
+//--------------------------------------------------------------------+
+// Binary Log
+//--------------------------------------------------------------------+
+static uint16_t bin_payload_len(void const* hdr)
+{
+  return 4 * ((adalog_bin_rec_t const*) hdr)->argc;
+}
+
+/**
+ * Record a log entry without formatting, called by ADALOG() in binary mode.
+ * Safe from any task or ISR, the entry is dropped if the ring is full.
+ * @param level
+ * @param fmt   format string in adalog_fmt section
+ * @param argc
+ * @param args
+ */
+void adalog_bin_write(uint8_t level, const char* fmt, uint8_t argc, uint32_t const* args)
+{
+  argc = min8(argc, ADALOG_BIN_MAX_ARGS);
+
+  adalog_bin_rec_t const rec =
+  {
+    .fmt_off = (uint16_t) (fmt - __start_adalog_fmt),
+    .level   = level,
+    .argc    = argc,
+    .ts      = os_time_get()
+  };
+
+#if MYNEWT_VAL(ADAUTIL_LOG_CRASH)
+  /* Kept raw even if the ring is full or the device crashes before
+   * formatting, crash_recover() formats it at next boot */
+  crash_write(CRASH_BIN, &rec, sizeof(rec), args, 4*argc);
+#endif
+
+  if ( !ring_write(&_bin.ring, &rec, sizeof(rec), args, 4*argc) ) return;
+
+#if MYNEWT_VAL(ADAUTIL_LOG_ASYNC)
+  /* Format later in the log task */
+  os_eventq_put(&_async.evq, &_bin.ev);
+#else
+  /* Format later in the main task */
+  os_eventq_put(os_eventq_dflt_get(), &_bin.ev);
+#endif
+}
+
+/**
+ * Pop the oldest record from the ring
+ * @param rec
+ * @param args  room for ADALOG_BIN_MAX_ARGS arguments
+ * @return false if ring is empty
+ */
+bool adalog_bin_read(adalog_bin_rec_t* rec, uint32_t* args)
+{
+  return ring_read(&_bin.ring, rec, sizeof(*rec), bin_payload_len, args, 4*ADALOG_BIN_MAX_ARGS) >= 0;
+}
+
+/**
+ * Format string of a record
+ * @param rec
+ * @return
+ */
+const char* adalog_bin_fmt(adalog_bin_rec_t const* rec)
+{
+  return __start_adalog_fmt + rec->fmt_off;
+}
+
+/**
+ * Number of records dropped because the ring was full
+ * @return
+ */
+uint32_t adalog_bin_dropped(void)
+{
+  return _bin.ring.dropped;
+}
+
+/**
+ * Event callback, format pending records.
+ * Arguments are passed as 32-bit words, matching %d %u %x %s %c %p on target.
+ * @param ev
+ */
+static void adalog_bin_drain(struct os_event* ev)
+{
+  (void) ev;
+
+  adalog_bin_rec_t rec;
+  uint32_t a[ADALOG_BIN_MAX_ARGS] = { 0 };
+
+  while ( adalog_bin_read(&rec, a) )
+  {
+#if MYNEWT_VAL(ADAUTIL_LOG_ASYNC)
+    /* Already in log task, go straight to sinks rather than back to the ring */
+    char line[ASYNC_LINE_MAX];
+    int len = snprintf(line, sizeof(line), "[ts=%lu, mod=%u level=%u] ", (unsigned long) rec.ts, LOG_MODULE_ADA, rec.level);
+    len += snprintf(line+len, sizeof(line)-len, adalog_bin_fmt(&rec), a[0], a[1], a[2], a[3], a[4], a[5]);
+
+    len = min16(len, sizeof(line)-1);
+    adalog_sink_write(line, len);
+#else
+    /* Same output as the console log handler. Not through adalog, the
+     * record is already in the crash log */
+    console_printf("[ts=%lu, mod=%u level=%u] ", (unsigned long) rec.ts, LOG_MODULE_ADA, rec.level);
+    console_printf(adalog_bin_fmt(&rec), a[0], a[1], a[2], a[3], a[4], a[5]);
+#endif
+  }
+
+#if MYNEWT_VAL(ADAUTIL_LOG_ASYNC)
+  adalog_sink_flush();
+#endif
+}
+
+#endif // ADAUTIL_LOG_BINARY
+
+#if MYNEWT_VAL(ADAUTIL_LOG_ASYNC)
+//--------------------------------------------------------------------+
+// Async Log
+//--------------------------------------------------------------------+
+static uint16_t async_payload_len(void const* hdr)
+{
+  return ((async_rec_t const*) hdr)->len;
+}
+
+/**
+ * Log handler append, the already formatted entry is queued and the caller
+ * returns without waiting for the console.
+ * @param log
+ * @param buf   log_entry_hdr followed by message
+ * @param len
+ * @return
+ */
+static int async_append(struct log* log, void* buf, int len)
+{
+  (void) log;
+
+#if MYNEWT_VAL(ADAUTIL_LOG_CRASH)
+  /* Kept even if the queue is full or the device crashes before draining */
+  crash_put(buf, len);
+#endif
+
+  struct log_entry_hdr const* hdr = (struct log_entry_hdr const*) buf;
+
+  async_rec_t const rec =
+  {
+    .len    = len - sizeof(*hdr),
+    .module = hdr->ue_module,
+    .level  = hdr->ue_level,
+    .ts     = (uint32_t) hdr->ue_ts
+  };
+
+  if ( ring_write(&_async.ring, &rec, sizeof(rec), hdr+1, rec.len) )
+  {
+    os_eventq_put(&_async.evq, &_async.ev);
+  }
+
+  return 0;
+}
+
+/**
+ * Event callback in log task, write queued entries to all sinks
+ * @param ev
+ */
+static void async_drain(struct os_event* ev)
+{
+  (void) ev;
+
+  async_rec_t rec;
+  char line[ASYNC_LINE_MAX];
+  int count;
+
+  while ( (count = ring_read(&_async.ring, &rec, sizeof(rec), async_payload_len, line, sizeof(line))) >= 0 )
+  {
+    char prefix[40];
+    int plen = snprintf(prefix, sizeof(prefix), "[ts=%lu, mod=%u level=%u] ", (unsigned long) rec.ts, rec.module, rec.level);
+
+    adalog_sink_write(prefix, plen);
+    adalog_sink_write(line, count);
+  }
+
+  /* Report drops once the burst is over */
+  uint32_t const dropped = adalog_dropped();
+  if ( dropped != _async.dropped_reported )
+  {
+    char msg[40];
+    int len = snprintf(msg, sizeof(msg), "[adalog] %lu dropped\n", (unsigned long) (dropped - _async.dropped_reported));
+    adalog_sink_write(msg, len);
+
+    _async.dropped_reported = dropped;
+  }
+
+  adalog_sink_flush();
+}
+
+/**
+ * Log task, low priority so that logging never delays other tasks
+ * @param arg
+ */
+static void adalog_async_task(void* arg)
+{
+  (void) arg;
+
+  while (1)
+  {
+    os_eventq_run(&_async.evq);
+  }
+}
+
+/**
+ * Add an output to the log task, console is added by adalog_init()
+ * @param sink  caller allocated, must stay valid
+ */
+void adalog_add_sink(adalog_sink_t* sink)
+{
+  SLIST_INSERT_HEAD(&_async.sinks, sink, next);
+}
+
+/**
+ * Write to all sinks, should only be called in log task
+ * @param data
+ * @param len
+ */
+void adalog_sink_write(const char* data, uint16_t len)
+{
+  adalog_sink_t* sink;
+  SLIST_FOREACH(sink, &_async.sinks, next)
+  {
+    sink->write(data, len, sink->arg);
+  }
+}
+
+/**
+ * Let buffering sinks send what they hold, called once the queue is drained
+ */
+void adalog_sink_flush(void)
+{
+  adalog_sink_t* sink;
+  SLIST_FOREACH(sink, &_async.sinks, next)
+  {
+    if ( sink->flush ) sink->flush(sink->arg);
+  }
+}
+
+static void console_sink_write(const char* line, uint16_t len, void* arg)
+{
+  (void) arg;
+  console_write(line, len);
+}
+
+/**
+ * Number of log entries dropped because the queue was full
+ * @return
+ */
+uint32_t adalog_dropped(void)
+{
+  uint32_t count = _async.ring.dropped;
+
+#if MYNEWT_VAL(ADAUTIL_LOG_BINARY)
+  count += _bin.ring.dropped;
+#endif
+
+  return count;
+}
+
+#endif // ADAUTIL_LOG_ASYNC
+
+#if MYNEWT_VAL(ADAUTIL_LOG_CRASH)
+//--------------------------------------------------------------------+
+// Crash Log
+//--------------------------------------------------------------------+
+static inline uint32_t crash_check(void)
+{
+  return CRASH_MAGIC ^ ((uint32_t) _crash.head << 16) ^ _crash.tail;
+}
+
+static void crash_copy_out(uint16_t pos, void* data, uint16_t len)
+{
+  uint8_t* dst = (uint8_t*) data;
+  while ( len-- ) *dst++ = _crash.buf[(pos++) & (CRASH_SIZE-1)];
+}
+
+/**
+ * Identify the format strings of the running image, binary records written
+ * by another image (e.g before a firmware upgrade) are not formatted
+ * @return
+ */
+static uint32_t crash_fmt_id(void)
+{
+  uint32_t id = 2166136261UL;
+
+#if MYNEWT_VAL(ADAUTIL_LOG_BINARY)
+  /* FNV-1a of the adalog_fmt section */
+  for(const char* p = __start_adalog_fmt; p < __stop_adalog_fmt; p++)
+  {
+    id = (id ^ (uint8_t) *p) * 16777619UL;
+  }
+#endif
+
+  return id;
+}
+
+/**
+ * Append an entry of len bytes (length prefix not included) to
+ * _crash_prev, dropping its oldest entries if needed
+ * @return where to copy the length prefix and entry
+ */
+static uint8_t* crash_prev_reserve(uint16_t len)
+{
+  uint16_t drop = 0;
+  while ( _crash_prev_len - drop + len + 2 > CRASH_SIZE )
+  {
+    uint16_t old_len;
+    memcpy(&old_len, _crash_prev + drop, 2);
+    drop += old_len + 2;
+  }
+
+  if ( drop )
+  {
+    memmove(_crash_prev, _crash_prev + drop, _crash_prev_len - drop);
+    _crash_prev_len -= drop;
+  }
+
+  uint8_t* entry = _crash_prev + _crash_prev_len;
+  _crash_prev_len += len + 2;
+
+  return entry;
+}
+
+#if MYNEWT_VAL(ADAUTIL_LOG_BINARY)
+/**
+ * Format a binary record of the ring into a log entry of _crash_prev. The
+ * format string is only used if the record was written by this image,
+ * otherwise its offset and the raw arguments are shown.
+ * @param pos       record position in the ring
+ * @param len       record length
+ * @param same_fmt  image format strings match
+ * @return false if the record is malformed
+ */
+static bool crash_recover_bin(uint16_t pos, uint16_t len, bool same_fmt)
+{
+  adalog_bin_rec_t rec;
+  uint32_t a[ADALOG_BIN_MAX_ARGS] = { 0 };
+
+  if ( len < sizeof(rec) ) return false;
+  crash_copy_out(pos, &rec, sizeof(rec));
+
+  if ( rec.argc > ADALOG_BIN_MAX_ARGS || len != sizeof(rec) + 4*rec.argc ) return false;
+  crash_copy_out(pos + sizeof(rec), a, 4*rec.argc);
+
+  char text[CRASH_LINE_MAX];
+  int count;
+
+  if ( same_fmt && rec.fmt_off < (uint16_t) (__stop_adalog_fmt - __start_adalog_fmt) )
+  {
+    count = snprintf(text, sizeof(text), adalog_bin_fmt(&rec), a[0], a[1], a[2], a[3], a[4], a[5]);
+  }
+  else
+  {
+    count = snprintf(text, sizeof(text), "fmt %u: %lx %lx %lx %lx %lx %lx\n", rec.fmt_off,
+                     (unsigned long) a[0], (unsigned long) a[1], (unsigned long) a[2],
+                     (unsigned long) a[3], (unsigned long) a[4], (unsigned long) a[5]);
+  }
+
+  count = (count < 0) ? 0 : min16(count, sizeof(text)-1);
+
+  struct log_entry_hdr hdr;
+  varclr(hdr);
+  hdr.ue_ts     = rec.ts;
+  hdr.ue_module = LOG_MODULE_ADA;
+  hdr.ue_level  = rec.level;
+
+  uint16_t const entry_len = sizeof(hdr) + count;
+  uint8_t* entry = crash_prev_reserve(entry_len);
+
+  memcpy(entry, &entry_len, 2);
+  memcpy(entry + 2, &hdr, sizeof(hdr));
+  memcpy(entry + 2 + sizeof(hdr), text, count);
+
+  return true;
+}
+#endif
+
+/**
+ * Copy ring content of previous boot (if any) to _crash_prev, then start
+ * a new ring. Entries are checked so that RAM garbage after power on is
+ * not taken for log. Binary records are formatted here.
+ */
+static void crash_recover(void)
+{
+  uint32_t const fmt_id = crash_fmt_id();
+
+  _crash_prev_len = 0;
+
+  if ( _crash.magic == CRASH_MAGIC && _crash.check == crash_check() &&
+       (uint16_t) (_crash.head - _crash.tail) <= CRASH_SIZE )
+  {
+    uint16_t pos = _crash.tail;
+    while ( pos != _crash.head )
+    {
+      uint16_t tag;
+      crash_copy_out(pos, &tag, 2);
+
+      uint16_t const len = tag & ~CRASH_BIN;
+      if ( (uint16_t) (_crash.head - pos) < len + 2 ) break;
+
+      if ( tag & CRASH_BIN )
+      {
+#if MYNEWT_VAL(ADAUTIL_LOG_BINARY)
+        if ( !crash_recover_bin(pos + 2, len, _crash.fmt_id == fmt_id) ) break;
+#else
+        break;
+#endif
+      }
+      else
+      {
+        if ( len < sizeof(struct log_entry_hdr) ) break;
+        crash_copy_out(pos, crash_prev_reserve(len), len + 2);
+      }
+
+      pos += len + 2;
+    }
+  }
+
+  _crash.head   = _crash.tail = 0;
+  _crash.magic  = CRASH_MAGIC;
+  _crash.fmt_id = fmt_id;
+  _crash.check  = crash_check();
+}
+
+/**
+ * Write an entry made of header and data into the retained ring,
+ * overwriting oldest entries
+ * @param flag  CRASH_BIN for a binary record, 0 for a log entry
+ */
+static void crash_write(uint16_t flag, void const* hdr, uint16_t hdr_len, void const* data, uint16_t data_len)
+{
+  uint16_t const len = hdr_len + data_len;
+  if ( len + 2 > CRASH_SIZE ) return;
+
+  uint16_t const tag = len | flag;
+
+  os_sr_t sr;
+  OS_ENTER_CRITICAL(sr);
+
+  while ( (uint16_t) (CRASH_SIZE - (uint16_t) (_crash.head - _crash.tail)) < len + 2 )
+  {
+    uint16_t old_tag;
+    crash_copy_out(_crash.tail, &old_tag, 2);
+    _crash.tail += (old_tag & ~CRASH_BIN) + 2;
+  }
+
+  uint8_t const* src = (uint8_t const*) &tag;
+  for(uint8_t i=0; i<2; i++) _crash.buf[(_crash.head++) & (CRASH_SIZE-1)] = src[i];
+
+  src = (uint8_t const*) hdr;
+  for(uint16_t i=0; i<hdr_len; i++) _crash.buf[(_crash.head++) & (CRASH_SIZE-1)] = src[i];
+
+  src = (uint8_t const*) data;
+  for(uint16_t i=0; i<data_len; i++) _crash.buf[(_crash.head++) & (CRASH_SIZE-1)] = src[i];
+
+  _crash.check = crash_check();
+
+  OS_EXIT_CRITICAL(sr);
+}
+
+/**
+ * Write a log entry into the retained ring, overwriting oldest entries
+ * @param entry log_entry_hdr followed by message
+ * @param len
+ */
+static void crash_put(void const* entry, uint16_t len)
+{
+  crash_write(0, entry, len, NULL, 0);
+}
+
+#if !MYNEWT_VAL(ADAUTIL_LOG_ASYNC)
+static int crash_tee_append(struct log* log, void* buf, int len)
+{
+  crash_put(buf, len);
+  return log_console_handler.log_append(log, buf, len);
+}
+#endif
+
+/**
+ * adalog_crash log handler. Entries appended to it go to the retained ring,
+ * read and walk return entries recovered from previous boot.
+ */
+static int crash_append(struct log* log, void* buf, int len)
+{
+  (void) log;
+  crash_put(buf, len);
+  return 0;
+}
+
+static int crash_read(struct log* log, void* dptr, void* buf, uint16_t offset, uint16_t len)
+{
+  (void) log;
+
+  /* dptr is offset of entry in _crash_prev */
+  uint16_t const pos = (uint16_t) (uintptr_t) dptr;
+
+  uint16_t entry_len;
+  memcpy(&entry_len, _crash_prev + pos, 2);
+
+  if ( offset >= entry_len ) return 0;
+  len = min16(len, entry_len - offset);
+
+  memcpy(buf, _crash_prev + pos + 2 + offset, len);
+  return len;
+}
+
+static int crash_walk(struct log* log, log_walk_func_t walk_func, struct log_offset* log_offset)
+{
+  uint16_t pos = 0;
+  while ( pos < _crash_prev_len )
+  {
+    uint16_t entry_len;
+    memcpy(&entry_len, _crash_prev + pos, 2);
+
+    int rc = walk_func(log, log_offset, (void*) (uintptr_t) pos, entry_len);
+    if ( rc ) return rc;
+
+    pos += entry_len + 2;
+  }
+
+  return 0;
+}
+
+static int crash_flush(struct log* log)
+{
+  (void) log;
+  _crash_prev_len = 0;
+  return 0;
+}
+
+#if MYNEWT_VAL(SELFTEST)
+/**
+ * Unit test hook, recover the ring as at next boot
+ * @param corrupt  move the tail past the oldest entry without updating the
+ *                 check word, as a stray write would. The rest still parses,
+ *                 only the check word rejects it
+ */
+void adalog_crash_reboot(bool corrupt)
+{
+  if ( corrupt && _crash.head != _crash.tail )
+  {
+    uint16_t tag;
+    crash_copy_out(_crash.tail, &tag, 2);
+    _crash.tail += (tag & ~CRASH_BIN) + 2;
+  }
+
+  crash_recover();
+}
+#endif
+
+#endif // ADAUTIL_LOG_CRASH
@@ -0,0 +1,335 @@
+#include <string.h>
+#include <testutil/testutil.h>
+#include "test_adautil.h"
+
+#include "adafruit/adautil.h"
+#include <fcb/fcb.h>
+#include <flash_map/flash_map.h>
+
+/* Variables are stored in an FCB on the native BSP simulated flash.
+ * flash_area_write() and fcb_rotate() are wrapped by the linker (pkg.lflags)
+ * to count writes and rotations, and to make them fail on demand */
+#define SAVE_MAX      20000 // bound of save loops filling the FCB
+
+enum { VAR_U8, VAR_U32, VAR_STR, VAR_BLOB, VAR_HIDDEN, VAR_COUNT };
+
+static uint8_t  _u8;
+static uint32_t _u32;
+static char     _str[16];
+static uint8_t  _blob[64];
+static uint8_t  _hidden;
+
+static const adacfg_info_t _test_vars[VAR_COUNT+1] =
+{
+  [VAR_U8]     = { "test/u8"  , CONF_INT8  , sizeof(_u8)  , &_u8     },
+  [VAR_U32]    = { "test/u32" , CONF_INT32 , sizeof(_u32) , &_u32    },
+  [VAR_STR]    = { "test/str" , CONF_STRING, sizeof(_str) , _str     },
+  [VAR_BLOB]   = { "test/blob", CONF_BYTES , sizeof(_blob), _blob    },
+  [VAR_HIDDEN] = { "hidden"   , CONF_INT8  , sizeof(_hidden), &_hidden },
+  [VAR_COUNT]  = { NULL }
+};
+
+int __real_flash_area_write(const struct flash_area *fa, uint32_t off, const void *src, uint32_t len);
+int __real_fcb_rotate(struct fcb *fcb);
+
+static uint32_t _write_count;
+static uint32_t _write_fail_at;   // _write_count of the write to fail, 0 none
+static uint32_t _rotate_count;
+static bool     _rotate_fail;     // return before erasing, as if reset
+
+int __wrap_flash_area_write(const struct flash_area *fa, uint32_t off, const void *src, uint32_t len)
+{
+  _write_count++;
+  if ( _write_count == _write_fail_at ) return -1;
+
+  return __real_flash_area_write(fa, off, src, len);
+}
+
+int __wrap_fcb_rotate(struct fcb *fcb)
+{
+  _rotate_count++;
+  if ( _rotate_fail ) return FCB_ERR_FLASH;
+
+  return __real_fcb_rotate(fcb);
+}
+
+/* Listeners, each counts its calls */
+static uint32_t _group_calls;
+static uint32_t _hidden_calls;
+static uint32_t _all_calls;
+
+static void count_call(void* arg)
+{
+  (*(uint32_t*) arg)++;
+}
+
+static adacfg_listener_t _group_listener  = { .name = "test/", .cb = count_call, .arg = &_group_calls  };
+static adacfg_listener_t _hidden_listener = { .name = "hidden", .cb = count_call, .arg = &_hidden_calls };
+static adacfg_listener_t _all_listener    = { .name = NULL    , .cb = count_call, .arg = &_all_calls    };
+
+/* Config handler can only be registered once, shared by all cases */
+static void test_setup(void)
+{
+  static bool initialized = false;
+  if ( initialized ) return;
+
+  TEST_ASSERT_FATAL( 0 == adacfg_init(NULL) );
+  TEST_ASSERT_FATAL( 0 == adacfg_add(_test_vars) );
+  TEST_ASSERT_FATAL( 0 == adacfg_listen(&_group_listener) );
+  TEST_ASSERT_FATAL( 0 == adacfg_listen(&_hidden_listener) );
+  TEST_ASSERT_FATAL( 0 == adacfg_listen(&_all_listener) );
+
+  initialized = true;
+}
+
+static void test_set_dirty(uint8_t idx)
+{
+  TEST_ASSERT( 0 == adacfg_set_dirty(_test_vars[idx].name) );
+}
+
+static void test_clear(void)
+{
+  _u8 = 0;
+  _u32 = 0;
+  varclr(_str);
+  varclr(_blob);
+  _hidden = 0;
+}
+
+/* Values written by the n-th pass of a save loop */
+static void test_fill(uint32_t n)
+{
+  _u32 = n;
+  memset(_blob, (uint8_t) n, sizeof(_blob));
+  test_set_dirty(VAR_U32);
+  test_set_dirty(VAR_BLOB);
+}
+
+static bool test_filled(uint32_t n)
+{
+  for(uint8_t i=0; i<sizeof(_blob); i++)
+  {
+    if ( _blob[i] != (uint8_t) n ) return false;
+  }
+
+  return _u32 == n;
+}
+
+/* Saved once before the save loops and never written again: only the
+ * snapshot taken on rotation keeps them */
+static void test_set_kept(void)
+{
+  _u8 = 0x5a;
+  strcpy(_str, "keep");
+  test_set_dirty(VAR_U8);
+  test_set_dirty(VAR_STR);
+  TEST_ASSERT( 0 == adacfg_save() );
+}
+
+static bool test_kept(void)
+{
+  return _u8 == 0x5a && 0 == strcmp(_str, "keep");
+}
+
+/* Same FNV-1a hash as "dup/ujtra" */
+static uint8_t _dup[3];
+static const adacfg_info_t _dup_vars[] =
+{
+  { "dup/first", CONF_INT8, 1, &_dup[0] },
+  { "dup/oikxw", CONF_INT8, 1, &_dup[1] },
+  { "dup/ujtra", CONF_INT8, 1, &_dup[2] },
+  { NULL }
+};
+
+TEST_CASE(test_adacfg_index)
+{
+  char buf[16];
+
+  test_setup();
+
+  /* Whole name only */
+  TEST_ASSERT( 0         == adacfg_set_dirty("test/u32") );
+  TEST_ASSERT( OS_ENOENT == adacfg_set_dirty("test") );
+  TEST_ASSERT( OS_ENOENT == adacfg_set_dirty("test/u3") );
+  TEST_ASSERT( OS_ENOENT == adacfg_set_dirty("test/u32/x") );
+
+  _u32 = 1234;
+  TEST_ASSERT( 0 == strcmp("1234", conf_get_value("adafruit/test/u32", buf, sizeof(buf))) );
+  TEST_ASSERT( NULL == conf_get_value("adafruit/test/none", buf, sizeof(buf)) );
+
+  /* A collision fails the whole array, variables before it included */
+  TEST_ASSERT( OS_EINVAL == adacfg_add(_dup_vars) );
+  TEST_ASSERT( OS_ENOENT == adacfg_set_dirty("dup/first") );
+  TEST_ASSERT( OS_ENOENT == adacfg_set_dirty("dup/oikxw") );
+
+  for(uint8_t i=0; i<VAR_COUNT; i++) test_set_dirty(i);
+  TEST_ASSERT( 0 == adacfg_save() );
+}
+
+TEST_CASE(test_adacfg_save_retry)
+{
+  uint32_t count;
+
+  test_setup();
+
+  /* Nothing dirty, nothing written */
+  count = _write_count;
+  TEST_ASSERT( 0 == adacfg_save() );
+  TEST_ASSERT( _write_count == count );
+
+  /* Fail in the middle of the entry, after its length is written */
+  _u32 = 0x12345678;
+  strcpy(_str, "retry");
+  test_set_dirty(VAR_U32);
+  test_set_dirty(VAR_STR);
+
+  _write_fail_at = _write_count + 3;
+  TEST_ASSERT( 0 != adacfg_save() );
+  _write_fail_at = 0;
+
+  /* Still dirty, the same batch is written again */
+  count = _write_count;
+  TEST_ASSERT( 0 == adacfg_save() );
+  TEST_ASSERT( _write_count > count );
+
+  count = _write_count;
+  TEST_ASSERT( 0 == adacfg_save() );
+  TEST_ASSERT( _write_count == count );
+
+  /* The partial entry is skipped on load */
+  test_clear();
+  TEST_ASSERT( 0 == adacfg_load() );
+  TEST_ASSERT( _u32 == 0x12345678 );
+  TEST_ASSERT( 0 == strcmp(_str, "retry") );
+}
+
+static bool test_filter(const adacfg_info_t* var, enum conf_export_tgt tgt)
+{
+  return !(tgt == CONF_EXPORT_PERSIST && var == &_test_vars[VAR_HIDDEN]);
+}
+
+TEST_CASE(test_adacfg_export_filter)
+{
+  test_setup();
+
+  /* Loaded as saved by test_adacfg_index */
+  _hidden = 1;
+  TEST_ASSERT( 0 == adacfg_load() );
+  TEST_ASSERT( _hidden == 0 );
+
+  adacfg_set_export_filter(test_filter);
+
+  _u8 = 7;
+  _hidden = 9;
+  test_set_dirty(VAR_U8);
+  test_set_dirty(VAR_HIDDEN);
+  TEST_ASSERT( 0 == adacfg_save() );
+
+  test_clear();
+  TEST_ASSERT( 0 == adacfg_load() );
+  TEST_ASSERT( _u8 == 7 );
+  TEST_ASSERT( _hidden == 0 );
+
+  adacfg_set_export_filter(NULL);
+}
+
+TEST_CASE(test_adacfg_listener)
+{
+  test_setup();
+
+  uint32_t const group  = _group_calls;
+  uint32_t const hidden = _hidden_calls;
+  uint32_t const all    = _all_calls;
+
+  /* Several variables set, one call per commit */
+  TEST_ASSERT( 0 == conf_set_value("adafruit/test/u8", "3") );
+  TEST_ASSERT( 0 == conf_set_value("adafruit/test/u32", "4") );
+  TEST_ASSERT( 0 == conf_set_value("adafruit/test/str", "five") );
+  TEST_ASSERT( _group_calls == group && _all_calls == all );
+
+  TEST_ASSERT( 0 == conf_commit(NULL) );
+  TEST_ASSERT( _group_calls == group+1 );
+  TEST_ASSERT( _hidden_calls == hidden );
+  TEST_ASSERT( _all_calls == all+1 );
+
+  TEST_ASSERT( 0 == conf_set_value("adafruit/hidden", "1") );
+  TEST_ASSERT( 0 == conf_commit(NULL) );
+  TEST_ASSERT( _group_calls == group+1 );
+  TEST_ASSERT( _hidden_calls == hidden+1 );
+  TEST_ASSERT( _all_calls == all+2 );
+
+  /* Nothing changed since */
+  TEST_ASSERT( 0 == conf_commit(NULL) );
+  TEST_ASSERT( _all_calls == all+2 );
+
+  /* Set through config management: dirty, a load is one more commit */
+  TEST_ASSERT( 0 == adacfg_save() );
+  TEST_ASSERT( 0 == adacfg_load() );
+  TEST_ASSERT( _group_calls == group+2 );
+  TEST_ASSERT( _hidden_calls == hidden+2 );
+  TEST_ASSERT( _all_calls == all+3 );
+  TEST_ASSERT( _u32 == 4 && 0 == strcmp(_str, "five") );
+}
+
+TEST_CASE(test_adacfg_rotate)
+{
+  uint32_t const rotations = _rotate_count;
+  uint32_t n;
+
+  test_setup();
+  test_set_kept();
+
+  for(n=0; n<SAVE_MAX && _rotate_count == rotations; n++)
+  {
+    test_fill(n);
+    TEST_ASSERT_FATAL( 0 == adacfg_save() );
+  }
+  TEST_ASSERT_FATAL( _rotate_count == rotations+1 );
+
+  test_clear();
+  TEST_ASSERT( 0 == adacfg_load() );
+  TEST_ASSERT( test_kept() );
+  TEST_ASSERT( test_filled(n-1) );
+}
+
+TEST_CASE(test_adacfg_rotate_cut)
+{
+  uint32_t rotations = _rotate_count;
+  uint32_t n;
+  int rc = 0;
+
+  test_setup();
+  test_set_kept();
+
+  /* Stop between the snapshot and the erase of the oldest sector */
+  _rotate_fail = true;
+  for(n=0; n<SAVE_MAX && rc == 0; n++)
+  {
+    test_fill(n);
+    rc = adacfg_save();
+  }
+  _rotate_fail = false;
+
+  TEST_ASSERT_FATAL( rc != 0 );
+  TEST_ASSERT( _rotate_count == rotations+1 );
+
+  /* Nothing lost, the last values are in the snapshot */
+  test_clear();
+  TEST_ASSERT( 0 == adacfg_load() );
+  TEST_ASSERT( test_kept() );
+  TEST_ASSERT( test_filled(n-1) );
+
+  /* No scratch sector left, the next rotation is done first */
+  rotations = _rotate_count;
+  for( ; n<2*SAVE_MAX && _rotate_count == rotations; n++)
+  {
+    test_fill(n);
+    TEST_ASSERT_FATAL( 0 == adacfg_save() );
+  }
+  TEST_ASSERT_FATAL( _rotate_count == rotations+2 );
+
+  test_clear();
+  TEST_ASSERT( 0 == adacfg_load() );
+  TEST_ASSERT( test_kept() );
+  TEST_ASSERT( test_filled(n-1) );
+}
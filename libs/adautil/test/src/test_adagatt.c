@@ -0,0 +1,215 @@
+#include <string.h>
+#include <testutil/testutil.h>
+#include "test_adautil.h"
+
+#include "adafruit/adautil.h"
+#include "adafruit/ada_gatt.h"
+
+/* The access callback is driven directly with a fake access context, as
+ * the host would for a client on connection TEST_CONN */
+#define TEST_CONN     3
+
+enum { CHR_FIXED, CHR_VAR, CHR_CMD, CHR_COUNT };
+
+static uint8_t  _fixed[4];
+static uint8_t  _var[8];
+static uint16_t _var_len;
+static uint16_t _var_handle;
+static uint16_t _var_len_written;   // _var_len seen by on_write
+
+static uint8_t  _cmd[32];
+static uint16_t _cmd_len;
+static uint16_t _cmd_conn;
+static uint8_t  _cmd_count;
+
+static void var_written(uint16_t conn_hdl, struct os_mbuf* om)
+{
+  (void) conn_hdl;
+  (void) om;
+
+  _var_len_written = _var_len;
+}
+
+static void cmd_written(uint16_t conn_hdl, struct os_mbuf* om)
+{
+  _cmd_conn = conn_hdl;
+  _cmd_len  = OS_MBUF_PKTLEN(om);
+  os_mbuf_copydata(om, 0, min16(_cmd_len, sizeof(_cmd)), _cmd);
+  _cmd_count++;
+}
+
+static const adagatt_chr_t _test_chr[CHR_COUNT] =
+{
+  [CHR_FIXED] = { .name = "fixed", .uuid = BLE_UUID16_DECLARE(0xFF01),
+                  .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
+                  .value = _fixed, .max_len = sizeof(_fixed) },
+
+  [CHR_VAR]   = { .name = "var", .uuid = BLE_UUID16_DECLARE(0xFF02),
+                  .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
+                  .value = _var, .len = &_var_len, .max_len = sizeof(_var),
+                  .val_handle = &_var_handle, .on_write = var_written },
+
+  [CHR_CMD]   = { .name = "cmd", .uuid = BLE_UUID16_DECLARE(0xFF03),
+                  .flags = BLE_GATT_CHR_F_WRITE_NO_RSP,
+                  .on_write = cmd_written },
+};
+
+ADAGATT_SERVICE_DEF(_test_svc, "test_svc", BLE_UUID16_DECLARE(0xFF00), _test_chr);
+
+static int test_access(uint8_t op, uint8_t idx, struct os_mbuf* om)
+{
+  struct ble_gatt_chr_def const* def = &_test_svc.chr_def[idx];
+  struct ble_gatt_access_ctxt ctxt =
+  {
+    .op  = op,
+    .om  = om,
+    .chr = def
+  };
+
+  return def->access_cb(TEST_CONN, 0, &ctxt, def->arg);
+}
+
+static int test_write(uint8_t idx, void const* data, uint16_t len)
+{
+  struct os_mbuf* om = ble_hs_mbuf_from_flat(data, len);
+  TEST_ASSERT(om != NULL);
+  if ( om == NULL ) return BLE_HS_ENOMEM;
+
+  int const rc = test_access(BLE_GATT_ACCESS_OP_WRITE_CHR, idx, om);
+  os_mbuf_free_chain(om);
+
+  return rc;
+}
+
+/* Read into buf, len is set to the number of bytes returned */
+static int test_read(uint8_t idx, void* buf, uint16_t* len)
+{
+  struct os_mbuf* om = os_msys_get_pkthdr(0, 0);
+  *len = 0;
+  TEST_ASSERT(om != NULL);
+  if ( om == NULL ) return BLE_HS_ENOMEM;
+
+  int const rc = test_access(BLE_GATT_ACCESS_OP_READ_CHR, idx, om);
+
+  *len = OS_MBUF_PKTLEN(om);
+  os_mbuf_copydata(om, 0, *len, buf);
+  os_mbuf_free_chain(om);
+
+  return rc;
+}
+
+static uint32_t test_counter(uint8_t idx)
+{
+  return ((uint32_t*) (_test_svc.stats+1))[idx];
+}
+
+TEST_CASE(test_adagatt_register)
+{
+  TEST_ASSERT_FATAL( 0 == adagatt_register(&_test_svc) );
+
+  for (uint8_t i=0; i<CHR_COUNT; i++)
+  {
+    struct ble_gatt_chr_def const* def = &_test_svc.chr_def[i];
+
+    TEST_ASSERT( def->uuid       == _test_chr[i].uuid );
+    TEST_ASSERT( def->flags      == _test_chr[i].flags );
+    TEST_ASSERT( def->val_handle == _test_chr[i].val_handle );
+    TEST_ASSERT( def->arg        == &_test_svc );
+
+    /* One callback for the whole service */
+    TEST_ASSERT( def->access_cb != NULL );
+    TEST_ASSERT( def->access_cb == _test_svc.chr_def[0].access_cb );
+  }
+  TEST_ASSERT( _test_svc.chr_def[CHR_COUNT].uuid == NULL );
+
+  TEST_ASSERT( _test_svc.svc_def[0].type == BLE_GATT_SVC_TYPE_PRIMARY );
+  TEST_ASSERT( _test_svc.svc_def[0].characteristics == _test_svc.chr_def );
+  TEST_ASSERT( _test_svc.svc_def[1].type == 0 );
+}
+
+TEST_CASE(test_adagatt_read)
+{
+  uint8_t  buf[16];
+  uint16_t len;
+
+  /* Fixed length, always max_len */
+  memcpy(_fixed, "\x01\x02\x03\x04", 4);
+  TEST_ASSERT( 0 == test_read(CHR_FIXED, buf, &len) );
+  TEST_ASSERT( len == sizeof(_fixed) && 0 == memcmp(buf, _fixed, len) );
+
+  /* Variable length, current length only */
+  memcpy(_var, "abcdefgh", 8);
+  _var_len = 5;
+  TEST_ASSERT( 0 == test_read(CHR_VAR, buf, &len) );
+  TEST_ASSERT( len == 5 && 0 == memcmp(buf, "abcde", 5) );
+
+  /* No value buffer */
+  TEST_ASSERT( BLE_ATT_ERR_READ_NOT_PERMITTED == test_read(CHR_CMD, buf, &len) );
+  TEST_ASSERT( len == 0 );
+
+  /* Descriptor operations are not served */
+  TEST_ASSERT( BLE_ATT_ERR_UNLIKELY == test_access(BLE_GATT_ACCESS_OP_READ_DSC, CHR_FIXED, NULL) );
+}
+
+TEST_CASE(test_adagatt_write)
+{
+  /* Fixed length must be written as a whole */
+  TEST_ASSERT( 0 == test_write(CHR_FIXED, "\xA1\xA2\xA3\xA4", 4) );
+  TEST_ASSERT( 0 == memcmp(_fixed, "\xA1\xA2\xA3\xA4", 4) );
+
+  TEST_ASSERT( BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN == test_write(CHR_FIXED, "\xB1\xB2\xB3", 3) );
+  TEST_ASSERT( BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN == test_write(CHR_FIXED, "\xB1\xB2\xB3\xB4\xB5", 5) );
+  TEST_ASSERT( 0 == memcmp(_fixed, "\xA1\xA2\xA3\xA4", 4) );
+
+  /* Variable length up to max_len, length updated before on_write */
+  TEST_ASSERT( 0 == test_write(CHR_VAR, "xyz", 3) );
+  TEST_ASSERT( _var_len == 3 && 0 == memcmp(_var, "xyz", 3) );
+  TEST_ASSERT( _var_len_written == 3 );
+
+  TEST_ASSERT( 0 == test_write(CHR_VAR, "12345678", 8) );
+  TEST_ASSERT( _var_len == 8 && 0 == memcmp(_var, "12345678", 8) );
+
+  TEST_ASSERT( BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN == test_write(CHR_VAR, "123456789", 9) );
+  TEST_ASSERT( _var_len == 8 );
+
+  TEST_ASSERT( 0 == test_write(CHR_VAR, "", 0) );
+  TEST_ASSERT( _var_len == 0 );
+
+  /* Without value buffer any length goes to on_write */
+  static const char cmd[] = "longer than any max_len";
+  uint8_t const count = _cmd_count;
+
+  TEST_ASSERT( 0 == test_write(CHR_CMD, cmd, sizeof(cmd)) );
+  TEST_ASSERT( _cmd_count == count+1 );
+  TEST_ASSERT( _cmd_conn == TEST_CONN );
+  TEST_ASSERT( _cmd_len == sizeof(cmd) && 0 == memcmp(_cmd, cmd, sizeof(cmd)) );
+}
+
+TEST_CASE(test_adagatt_stats)
+{
+  uint8_t  buf[16];
+  uint16_t len;
+  uint32_t before[CHR_COUNT];
+
+  /* One named 32-bit counter per characteristic, in table order */
+  TEST_ASSERT( _test_svc.stats->s_size == sizeof(uint32_t) );
+  TEST_ASSERT( _test_svc.stats->s_cnt  == CHR_COUNT );
+
+  for (uint8_t i=0; i<CHR_COUNT; i++)
+  {
+    TEST_ASSERT( _test_svc.stat_names[i].snm_off == sizeof(struct stats_hdr) + i*sizeof(uint32_t) );
+    TEST_ASSERT( 0 == strcmp(_test_svc.stat_names[i].snm_name, _test_chr[i].name) );
+
+    before[i] = test_counter(i);
+  }
+
+  /* Rejected accesses are counted too */
+  test_read(CHR_FIXED, buf, &len);
+  test_read(CHR_FIXED, buf, &len);
+  test_write(CHR_FIXED, "\x00", 1);
+  test_write(CHR_CMD, "\x00", 1);
+
+  TEST_ASSERT( test_counter(CHR_FIXED) == before[CHR_FIXED] + 3 );
+  TEST_ASSERT( test_counter(CHR_VAR)   == before[CHR_VAR] );
+  TEST_ASSERT( test_counter(CHR_CMD)   == before[CHR_CMD] + 1 );
+}
@@ -0,0 +1,183 @@
+#include <string.h>
+#include <testutil/testutil.h>
+#include "test_adautil.h"
+
+#include "adafruit/adautil.h"
+
+/* Binary records of ADALOG() with the crash ring, see syscfg.yml. Records
+ * are never drained by the default event queue here, the ring is read
+ * directly. The crash ring is recovered by adalog_crash_reboot() as it
+ * would be at next boot */
+#define CRASH_MAX       16
+#define CRASH_TEXT_MAX  64
+
+/* Messages recovered in the adalog_crash log */
+static uint8_t _crash_count;
+static struct
+{
+  struct log_entry_hdr hdr;
+  char text[CRASH_TEXT_MAX];
+} _crash_entry[CRASH_MAX];
+
+static int crash_walk_cb(struct log* log, struct log_offset* log_offset, void* dptr, uint16_t len)
+{
+  (void) log_offset;
+
+  TEST_ASSERT( len >= sizeof(struct log_entry_hdr) );
+  if ( len < sizeof(struct log_entry_hdr) || _crash_count >= CRASH_MAX ) return 0;
+
+  uint16_t const text_len = min16(len - sizeof(struct log_entry_hdr), CRASH_TEXT_MAX-1);
+
+  TEST_ASSERT( sizeof(struct log_entry_hdr) == log_read(log, dptr, &_crash_entry[_crash_count].hdr, 0, sizeof(struct log_entry_hdr)) );
+  TEST_ASSERT( text_len == log_read(log, dptr, _crash_entry[_crash_count].text, sizeof(struct log_entry_hdr), text_len) );
+  _crash_entry[_crash_count].text[text_len] = 0;
+
+  _crash_count++;
+
+  return 0;
+}
+
+static void crash_reboot(bool corrupt)
+{
+  struct log_offset log_offset = { 0 };
+
+  adalog_crash_reboot(corrupt);
+
+  varclr(_crash_entry);
+  _crash_count = 0;
+  TEST_ASSERT( 0 == log_walk(&adalog_crash, crash_walk_cb, &log_offset) );
+}
+
+static void bin_drain(void)
+{
+  adalog_bin_rec_t rec;
+  uint32_t args[ADALOG_BIN_MAX_ARGS];
+
+  while ( adalog_bin_read(&rec, args) ) { }
+}
+
+TEST_CASE(test_adalog_bin)
+{
+  adalog_bin_rec_t rec;
+  uint32_t args[ADALOG_BIN_MAX_ARGS];
+
+  bin_drain();
+
+  /* Format string offset and raw arguments */
+  ADALOG(INFO, "two %u %x\n", 7, 0xbeef);
+  ADALOG(ERROR, "none\n");
+  ADALOG(DEBUG, "six %u %u %u %u %u %u\n", 1, 2, 3, 4, 5, 6);
+
+  TEST_ASSERT_FATAL( adalog_bin_read(&rec, args) );
+  TEST_ASSERT( rec.level == LOG_LEVEL_INFO && rec.argc == 2 );
+  TEST_ASSERT( args[0] == 7 && args[1] == 0xbeef );
+  TEST_ASSERT( 0 == strcmp("two %u %x\n", adalog_bin_fmt(&rec)) );
+
+  TEST_ASSERT_FATAL( adalog_bin_read(&rec, args) );
+  TEST_ASSERT( rec.level == LOG_LEVEL_ERROR && rec.argc == 0 );
+  TEST_ASSERT( 0 == strcmp("none\n", adalog_bin_fmt(&rec)) );
+
+  TEST_ASSERT_FATAL( adalog_bin_read(&rec, args) );
+  TEST_ASSERT( rec.level == LOG_LEVEL_DEBUG && rec.argc == 6 );
+  for(uint8_t i=0; i<6; i++) TEST_ASSERT( args[i] == i+1u );
+  TEST_ASSERT( 0 == strcmp("six %u %u %u %u %u %u\n", adalog_bin_fmt(&rec)) );
+
+  TEST_ASSERT( !adalog_bin_read(&rec, args) );
+
+  /* Arguments past the maximum are not recorded */
+  uint32_t const many[ADALOG_BIN_MAX_ARGS+2] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+  adalog_bin_write(LOG_LEVEL_WARN, adalog_bin_fmt(&rec), arrcount(many), many);
+
+  TEST_ASSERT_FATAL( adalog_bin_read(&rec, args) );
+  TEST_ASSERT( rec.argc == ADALOG_BIN_MAX_ARGS && args[5] == 6 );
+  TEST_ASSERT( 0 == strcmp("six %u %u %u %u %u %u\n", adalog_bin_fmt(&rec)) );
+}
+
+TEST_CASE(test_adalog_ring)
+{
+  adalog_bin_rec_t rec;
+  uint32_t args[ADALOG_BIN_MAX_ARGS];
+
+  bin_drain();
+
+  /* Full: the ring holds whole records only, the others are counted */
+  uint32_t const dropped = adalog_bin_dropped();
+  uint32_t const fit = MYNEWT_VAL(ADAUTIL_LOG_RING_SIZE) / (sizeof(rec) + 4);
+
+  for(uint32_t i=0; i<fit+3; i++) ADALOG(INFO, "full %u\n", i);
+  TEST_ASSERT( adalog_bin_dropped() == dropped + 3 );
+
+  for(uint32_t i=0; i<fit; i++)
+  {
+    TEST_ASSERT_FATAL( adalog_bin_read(&rec, args) );
+    TEST_ASSERT( rec.argc == 1 && args[0] == i );
+  }
+  TEST_ASSERT( !adalog_bin_read(&rec, args) );
+
+  /* Wrap: records straddle the buffer end, and the 16-bit indexes wrap */
+  for(uint32_t i=0; i<5000; i++)
+  {
+    ADALOG(INFO, "wrap %u %u\n", i, ~i);
+    ADALOG(INFO, "wrap %u\n", i);
+
+    TEST_ASSERT_FATAL( adalog_bin_read(&rec, args) );
+    TEST_ASSERT_FATAL( rec.argc == 2 && args[0] == i && args[1] == ~i );
+
+    TEST_ASSERT_FATAL( adalog_bin_read(&rec, args) );
+    TEST_ASSERT_FATAL( rec.argc == 1 && args[0] == i );
+  }
+
+  TEST_ASSERT( !adalog_bin_read(&rec, args) );
+  TEST_ASSERT( adalog_bin_dropped() == dropped + 3 );
+}
+
+TEST_CASE(test_adalog_crash)
+{
+  adalog_init();
+
+  /* Drop what previous cases logged */
+  crash_reboot(false);
+  crash_reboot(false);
+  TEST_ASSERT( _crash_count == 0 );
+
+  /* Text entries and binary records, formatted at recovery */
+  log_printf(&adalog, LOG_MODULE_ADA, LOG_LEVEL_WARN, "text %d\n", 1);
+  ADALOG(INFO, "bin %u %x\n", 7, 0xbeef);
+
+  crash_reboot(false);
+  TEST_ASSERT_FATAL( _crash_count == 2 );
+
+  TEST_ASSERT( _crash_entry[0].hdr.ue_module == LOG_MODULE_ADA );
+  TEST_ASSERT( _crash_entry[0].hdr.ue_level == LOG_LEVEL_WARN );
+  TEST_ASSERT( 0 == strcmp(_crash_entry[0].text, "text 1\n") );
+
+  TEST_ASSERT( _crash_entry[1].hdr.ue_module == LOG_MODULE_ADA );
+  TEST_ASSERT( _crash_entry[1].hdr.ue_level == LOG_LEVEL_INFO );
+  TEST_ASSERT( 0 == strcmp(_crash_entry[1].text, "bin 7 beef\n") );
+
+  /* Recovered once, the ring starts over */
+  crash_reboot(false);
+  TEST_ASSERT( _crash_count == 0 );
+
+  /* Oldest entries are overwritten, the newest are kept in order */
+  for(uint32_t i=0; i<100; i++) ADALOG(INFO, "seq %u\n", i);
+
+  crash_reboot(false);
+  TEST_ASSERT_FATAL( _crash_count > 1 );
+
+  for(uint8_t i=0; i<_crash_count; i++)
+  {
+    char text[CRASH_TEXT_MAX];
+    snprintf(text, sizeof(text), "seq %u\n", (unsigned) (100 - _crash_count + i));
+    TEST_ASSERT( 0 == strcmp(_crash_entry[i].text, text) );
+  }
+
+  /* Ring state does not match the check word, nothing is taken as log */
+  ADALOG(INFO, "lost %u\n", 1);
+  ADALOG(INFO, "lost %u\n", 2);
+
+  crash_reboot(true);
+  TEST_ASSERT( _crash_count == 0 );
+
+  bin_drain();
+}
@@ -0,0 +1,36 @@
+#include <sysinit/sysinit.h>
+#include <testutil/testutil.h>
+#include "test_adautil.h"
+
+TEST_SUITE(test_adautil_suite)
+{
+  test_adagatt_register();
+  test_adagatt_read();
+  test_adagatt_write();
+  test_adagatt_stats();
+
+  test_adacfg_index();
+  test_adacfg_save_retry();
+  test_adacfg_export_filter();
+  test_adacfg_listener();
+  test_adacfg_rotate();
+  test_adacfg_rotate_cut();
+
+  test_adalog_bin();
+  test_adalog_ring();
+  test_adalog_crash();
+}
+
+#ifdef MYNEWT_SELFTEST
+
+int main (int argc, char **argv)
+{
+  sysinit();
+
+  tu_config.tc_print_results = 1;
+  tu_init();
+  test_adautil_suite();
+  return tu_any_failed;
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef TEST_ADAUTIL_H
+#define TEST_ADAUTIL_H
+
+TEST_CASE_DECL(test_adagatt_register);
+TEST_CASE_DECL(test_adagatt_read);
+TEST_CASE_DECL(test_adagatt_write);
+TEST_CASE_DECL(test_adagatt_stats);
+
+TEST_CASE_DECL(test_adacfg_index);
+TEST_CASE_DECL(test_adacfg_save_retry);
+TEST_CASE_DECL(test_adacfg_export_filter);
+TEST_CASE_DECL(test_adacfg_listener);
+TEST_CASE_DECL(test_adacfg_rotate);
+TEST_CASE_DECL(test_adacfg_rotate_cut);
+
+TEST_CASE_DECL(test_adalog_bin);
+TEST_CASE_DECL(test_adalog_ring);
+TEST_CASE_DECL(test_adalog_crash);
+
+#endif /* TEST_ADAUTIL_H */
@@ -43,7 +43,48 @@
 //--------------------------------------------------------------------+
 // MACRO CONSTANT TYPEDEF
 //--------------------------------------------------------------------+
-enum { BLEDIS_MAX_CHAR = sizeof(bledis_cfg_t)/4 };
+enum { BLEDIS_MAX_CHAR = sizeof(bledis_cfg_t)/sizeof(const char*) };
+
+/* Whether a syscfg string is configured, as an integer constant expression.
+ * Unset strings are NULL i.e void*, set ones are char arrays.
+ * With BLEDIS_CFG every characteristic is present since any can be set later */
+#if MYNEWT_VAL(BLEDIS_CFG)
+  #define DIS_HAS(_str)   1
+#else
+  #define DIS_HAS(_str)   (!__builtin_types_compatible_p(__typeof__(_str), void*))
+#endif
+
+#if MYNEWT_VAL(BLEDIS_SERIAL_DYNAMIC)
+  #define DIS_HAS_SERIAL  1
+#else
+  #define DIS_HAS_SERIAL  DIS_HAS(MYNEWT_VAL(BLEDIS_SERIAL_STR))
+#endif
+
+/* Number of configured characteristics before each one */
+#define DIS_PRE_MODEL     0
+#define DIS_PRE_SERIAL    (DIS_PRE_MODEL    + DIS_HAS(MYNEWT_VAL(BLEDIS_MODEL_STR)))
+#define DIS_PRE_FIRMWARE  (DIS_PRE_SERIAL   + DIS_HAS_SERIAL)
+#define DIS_PRE_HARDWARE  (DIS_PRE_FIRMWARE + DIS_HAS(MYNEWT_VAL(BLEDIS_FIRMWARE_REV_STR)))
+#define DIS_PRE_SOFTWARE  (DIS_PRE_HARDWARE + DIS_HAS(MYNEWT_VAL(BLEDIS_HARDWARE_REV_STR)))
+#define DIS_PRE_MANUFACT  (DIS_PRE_SOFTWARE + DIS_HAS(MYNEWT_VAL(BLEDIS_SOFTWARE_REV_STR)))
+#define DIS_COUNT         (DIS_PRE_MANUFACT + DIS_HAS(MYNEWT_VAL(BLEDIS_MANUFACTURER_STR)))
+
+/* Configured characteristics are packed at the front of the table followed by
+ * the zero terminator, unused ones are parked after it where the stack never
+ * looks. Table size stays BLEDIS_MAX_CHAR+1 whatever the configuration. */
+#define DIS_CHR_IDX(_has, _pre, _n) \
+  ( (_has) ? (_pre) : (DIS_COUNT + 1 + (_n) - (_pre)) )
+
+#define DIS_CHR(_has, _pre, _n) \
+  [DIS_CHR_IDX(_has, _pre, _n)] = \
+  { \
+    .uuid      = &_dis_uuid[_n].u, \
+    .access_cb = bledis_access_cb, \
+    .arg       = (void*) (_n), \
+    .flags     = BLE_GATT_CHR_F_READ, \
+  }
+
+VERIFY_STATIC(__builtin_types_compatible_p(__typeof__(NULL), void*), "NULL is expected to be (void*) 0");
 
 
 //--------------------------------------------------------------------+
@@ -73,12 +114,17 @@ STATS_NAME_END(bledis_stat_section)
 
 STATS_SECT_DECL(bledis_stat_section) g_bledis_stats;
 
+VERIFY_STATIC(sizeof(g_bledis_stats) == sizeof(struct stats_hdr) + BLEDIS_MAX_CHAR*sizeof(uint32_t),
+              "one 32-bit counter per characteristic is expected");
+
 #endif
 
 #if MYNEWT_VAL(BLEDIS_ADALOG)
   #define _LOG(x)  x
+  #define BLEDIS_LOG(lvl, ...)  ADALOG_LVL(MYNEWT_VAL(BLEDIS_LOG_LEVEL), lvl, __VA_ARGS__)
 #else
   #define _LOG(x)
+  #define BLEDIS_LOG(lvl, ...)
 #endif
 
 
@@ -89,6 +135,40 @@ STATS_SECT_DECL(bledis_stat_section) g_bledis_stats;
 static char _dis_serial[16 + 1];
 #endif
 
+/* Current value of each characteristic, computed by bledis_init() and
+ * whenever adacfg overrides change */
+static const char* _dis_str[BLEDIS_MAX_CHAR];
+static uint16_t    _dis_len[BLEDIS_MAX_CHAR];
+
+#if MYNEWT_VAL(BLEDIS_CFG)
+
+#if !MYNEWT_VAL(ADAUTIL_CFG)
+#error "BLEDIS_CFG requires ADAUTIL_CFG"
+#endif
+
+/* Overrides set through config management, empty means syscfg value.
+ * adacfg writes them on set, before the commit: reads are served from a copy
+ * taken on commit, into the bank not being served */
+static char _dis_override[BLEDIS_MAX_CHAR][MYNEWT_VAL(BLEDIS_CFG_STRLEN)+1];
+static char _dis_served[BLEDIS_MAX_CHAR][2][MYNEWT_VAL(BLEDIS_CFG_STRLEN)+1];
+static uint8_t _dis_bank[BLEDIS_MAX_CHAR];
+
+ADACFG_STRING("dis/model"       , _dis_override[0]);
+ADACFG_STRING("dis/serial"      , _dis_override[1]);
+ADACFG_STRING("dis/firmware_rev", _dis_override[2]);
+ADACFG_STRING("dis/hardware_rev", _dis_override[3]);
+ADACFG_STRING("dis/software_rev", _dis_override[4]);
+ADACFG_STRING("dis/manufacturer", _dis_override[5]);
+
+static void bledis_cfg_changed(void* arg);
+
+static adacfg_listener_t _dis_listener =
+{
+  .name = "dis/",
+  .cb   = bledis_cfg_changed
+};
+#endif
+
 static union
 {
   bledis_cfg_t named;
@@ -122,7 +202,28 @@ const char * _dis_chr_text[] =
     "Manufacturer",
 };
 
-static struct ble_gatt_chr_def _dis_chars[BLEDIS_MAX_CHAR+1];
+static int bledis_access_cb(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+static const ble_uuid16_t _dis_uuid[BLEDIS_MAX_CHAR] =
+{
+    BLE_UUID16_INIT(UUID16_CHR_MODEL_NUMBER_STRING     ),
+    BLE_UUID16_INIT(UUID16_CHR_SERIAL_NUMBER_STRING    ),
+    BLE_UUID16_INIT(UUID16_CHR_FIRMWARE_REVISION_STRING),
+    BLE_UUID16_INIT(UUID16_CHR_HARDWARE_REVISION_STRING),
+    BLE_UUID16_INIT(UUID16_CHR_SOFTWARE_REVISION_STRING),
+    BLE_UUID16_INIT(UUID16_CHR_MANUFACTURER_NAME_STRING),
+};
+
+/* Built at compile time from syscfg, lives in flash */
+static const struct ble_gatt_chr_def _dis_chars[BLEDIS_MAX_CHAR+1] =
+{
+    DIS_CHR( DIS_HAS(MYNEWT_VAL(BLEDIS_MODEL_STR))        , DIS_PRE_MODEL   , 0 ),
+    DIS_CHR( DIS_HAS_SERIAL                               , DIS_PRE_SERIAL  , 1 ),
+    DIS_CHR( DIS_HAS(MYNEWT_VAL(BLEDIS_FIRMWARE_REV_STR)) , DIS_PRE_FIRMWARE, 2 ),
+    DIS_CHR( DIS_HAS(MYNEWT_VAL(BLEDIS_HARDWARE_REV_STR)) , DIS_PRE_HARDWARE, 3 ),
+    DIS_CHR( DIS_HAS(MYNEWT_VAL(BLEDIS_SOFTWARE_REV_STR)) , DIS_PRE_SOFTWARE, 4 ),
+    DIS_CHR( DIS_HAS(MYNEWT_VAL(BLEDIS_MANUFACTURER_STR)) , DIS_PRE_MANUFACT, 5 ),
+};
 
 static const struct ble_gatt_svc_def _dis_service[] =
 {
@@ -139,7 +240,56 @@ static const struct ble_gatt_svc_def _dis_service[] =
 //--------------------------------------------------------------------+
 // FUNCTION DECLARATION
 //--------------------------------------------------------------------+
-static int bledis_access_cb(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+/**
+ * Pick the value of a characteristic: a copy of the adacfg override if set,
+ * otherwise syscfg. Pointer and length are swapped together, and the copy
+ * goes to the other bank, so the host task never sees a mismatched pair.
+ * @param i index in bledis_cfg_t
+ */
+static void bledis_update(uint8_t i)
+{
+  const char* str = _dis_cfg.arrptr[i];
+
+#if MYNEWT_VAL(BLEDIS_CFG)
+  if ( _dis_override[i][0] )
+  {
+    _dis_bank[i] ^= 1;
+
+    char* copy = _dis_served[i][_dis_bank[i]];
+    size_t const n = strnlen(_dis_override[i], sizeof(_dis_override[i]) - 1);
+
+    memcpy(copy, _dis_override[i], n);
+    copy[n] = 0;
+
+    str = copy;
+  }
+#endif
+
+  if ( str == NULL ) str = "";
+
+  uint16_t const len = strlen(str);
+
+  os_sr_t sr;
+  OS_ENTER_CRITICAL(sr);
+  _dis_str[i] = str;
+  _dis_len[i] = len;
+  OS_EXIT_CRITICAL(sr);
+}
+
+#if MYNEWT_VAL(BLEDIS_CFG)
+/**
+ * adacfg listener, once per commit whatever the number of strings changed.
+ * Service stays registered, next read returns the new value.
+ * @param arg
+ */
+static void bledis_cfg_changed(void* arg)
+{
+  (void) arg;
+
+  for (uint8_t i=0; i<BLEDIS_MAX_CHAR; i++) bledis_update(i);
+}
+#endif
 
 int bledis_init(void)
 {
@@ -161,27 +311,21 @@ int bledis_init(void)
   sprintf(_dis_serial, "%08lX%08lX", NRF_FICR->DEVICEID[1], NRF_FICR->DEVICEID[0]);
 #endif
 
-  // Include only configured characteristics
-  int count = 0;
   for (int i=0; i<BLEDIS_MAX_CHAR; i++)
   {
+    bledis_update(i);
+
     if ( _dis_cfg.arrptr[i] != NULL )
     {
-      _LOG( ADALOG_INFO("[BLEDIS] %s added\n", _dis_chr_text[i]) );
-
-      ble_uuid16_t* uuid16 = (ble_uuid16_t*) malloc( sizeof(ble_uuid16_t) );
-      uuid16->u.type = BLE_UUID_TYPE_16;
-      uuid16->value = UUID16_CHR_MODEL_NUMBER_STRING+i;
-
-      _dis_chars[count].uuid      = &uuid16->u;
-      _dis_chars[count].access_cb = bledis_access_cb;
-      _dis_chars[count].flags     = BLE_GATT_CHR_F_READ;
-
-      count++;
+      BLEDIS_LOG(INFO, "[BLEDIS] %s added\n", _dis_chr_text[i]);
     }
   }
 
-  if ( count )
+#if MYNEWT_VAL(BLEDIS_CFG)
+  adacfg_listen(&_dis_listener);
+#endif
+
+  if ( DIS_COUNT )
   {
     // Register Service
     ble_gatts_count_cfg(_dis_service);
@@ -192,41 +336,43 @@ int bledis_init(void)
 }
 
 
-int bledis_access_cb(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+/**
+ * Read callback of all DIS characteristics
+ * @param conn_handle
+ * @param attr_handle
+ * @param ctxt
+ * @param arg   index of the characteristic in bledis_cfg_t
+ * @return
+ */
+static int bledis_access_cb(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
 {
-  if (ctxt->op != BLE_GATT_ACCESS_OP_READ_CHR) return (-1);
+  (void) conn_handle;
+  (void) attr_handle;
+
+  if (ctxt->op != BLE_GATT_ACCESS_OP_READ_CHR) return BLE_ATT_ERR_UNLIKELY;
 
-  uint16_t uuid16 = ble_uuid_u16(ctxt->chr->uuid);
-  if ( !is_within(UUID16_CHR_MODEL_NUMBER_STRING, uuid16, UUID16_CHR_MANUFACTURER_NAME_STRING) ) return (-1);
+  uint32_t const idx = (uintptr_t) arg;
 
-  const char* str = _dis_cfg.arrptr[uuid16 - UUID16_CHR_MODEL_NUMBER_STRING];
+  const char* str;
+  uint16_t len;
 
-  os_mbuf_append(ctxt->om, str, strlen(str));
+  os_sr_t sr;
+  OS_ENTER_CRITICAL(sr);
+  str = _dis_str[idx];
+  len = _dis_len[idx];
+  OS_EXIT_CRITICAL(sr);
 
 #if MYNEWT_VAL(BLEDIS_STATS)
-  /* Increment the stats counter */
-  switch (uuid16)
+  /* Counters are declared in characteristic order */
+  ((uint32_t*) (STATS_HDR(g_bledis_stats)+1))[idx]++;
+#endif
+
+  /* Whole value is always appended, the stack strips the offset of a
+   * Read Blob request itself */
+  if ( 0 != os_mbuf_append(ctxt->om, str, len) )
   {
-    case 0x2A24:  /* Model Number */
-      STATS_INC(g_bledis_stats, model_reads);
-      break;
-    case 0x2A25:  /* Serial Number */
-      STATS_INC(g_bledis_stats, serial_reads);
-      break;
-    case 0x2A26:  /* Firmware Revision */
-      STATS_INC(g_bledis_stats, firmware_rev_reads);
-      break;
-    case 0x2A27:  /* Hardware Revision */
-      STATS_INC(g_bledis_stats, hardware_rev_reads);
-      break;
-    case 0x2A28:  /* Software Revision */
-      STATS_INC(g_bledis_stats, software_rev_reads);
-      break;
-    case 0x2A29:  /* Manufacturer */
-      STATS_INC(g_bledis_stats, manufacturer_reads);
-      break;
+    return BLE_ATT_ERR_INSUFFICIENT_RES;
   }
-#endif
 
   return 0;
 }
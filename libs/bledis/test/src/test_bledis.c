@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <sysinit/sysinit.h>
+#include <testutil/testutil.h>
+#include "test_bledis.h"
+
+#include "host/ble_hs.h"
+#include "adafruit/bledis.h"
+#include "adafruit/adautil.h"
+
+/* malloc, calloc & realloc are wrapped by the linker (pkg.lflags) to count
+ * allocations. ble_gatts_add_svcs() grows its service list with realloc */
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t nmemb, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+static uint32_t _alloc_count;
+
+void* __wrap_malloc(size_t size)
+{
+  _alloc_count++;
+  return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t nmemb, size_t size)
+{
+  _alloc_count++;
+  return __real_calloc(nmemb, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+  _alloc_count++;
+  return __real_realloc(ptr, size);
+}
+
+/* Services passed by bledis_init(), also wrapped by the linker.
+ * Allocations made by the stack to grow its service list are counted
+ * apart from the ones made by bledis itself */
+int __real_ble_gatts_add_svcs(const struct ble_gatt_svc_def *svcs);
+
+static const struct ble_gatt_svc_def* _added_svcs;
+static uint32_t _stack_alloc_count;
+
+int __wrap_ble_gatts_add_svcs(const struct ble_gatt_svc_def *svcs)
+{
+  uint32_t const count = _alloc_count;
+  int rc;
+
+  _added_svcs = svcs;
+  rc = __real_ble_gatts_add_svcs(svcs);
+
+  _stack_alloc_count += _alloc_count - count;
+  _alloc_count = count;
+
+  return rc;
+}
+
+TEST_SUITE(test_bledis_suite)
+{
+  test_bledis_zero_heap();
+  test_bledis_chars();
+}
+
+#ifdef MYNEWT_SELFTEST
+
+int main (int argc, char **argv)
+{
+  sysinit();
+
+  tu_config.tc_print_results = 1;
+  tu_init();
+  test_bledis_suite();
+  return tu_any_failed;
+}
+
+#endif
+
+TEST_CASE(test_bledis_zero_heap)
+{
+  uint32_t const count = _alloc_count;
+  uint32_t const stack_count = _stack_alloc_count;
+
+  TEST_ASSERT_FATAL( 0 == bledis_init() );
+  TEST_ASSERT( count == _alloc_count );
+
+  /* One ble_gatts_add_svcs() call for the whole service, the stack grows
+   * its list of definitions once */
+  TEST_ASSERT( _stack_alloc_count - stack_count <= 1 );
+}
+
+/* Runs after test_bledis_zero_heap, checks the table bledis_init() added:
+ * configured strings only, in bledis_cfg_t order, zero terminated */
+TEST_CASE(test_bledis_chars)
+{
+  static const char* const cfg_str[] =
+  {
+    MYNEWT_VAL(BLEDIS_MODEL_STR),
+    MYNEWT_VAL(BLEDIS_SERIAL_STR),
+    MYNEWT_VAL(BLEDIS_FIRMWARE_REV_STR),
+    MYNEWT_VAL(BLEDIS_HARDWARE_REV_STR),
+    MYNEWT_VAL(BLEDIS_SOFTWARE_REV_STR),
+    MYNEWT_VAL(BLEDIS_MANUFACTURER_STR),
+  };
+
+  static const uint16_t cfg_uuid[] =
+  {
+    UUID16_CHR_MODEL_NUMBER_STRING,
+    UUID16_CHR_SERIAL_NUMBER_STRING,
+    UUID16_CHR_FIRMWARE_REVISION_STRING,
+    UUID16_CHR_HARDWARE_REVISION_STRING,
+    UUID16_CHR_SOFTWARE_REVISION_STRING,
+    UUID16_CHR_MANUFACTURER_NAME_STRING,
+  };
+
+  VERIFY_STATIC(arrcount(cfg_str) == sizeof(bledis_cfg_t)/sizeof(const char*), "one string per characteristic");
+
+  TEST_ASSERT_FATAL( _added_svcs != NULL );
+  TEST_ASSERT( ble_uuid_u16(_added_svcs[0].uuid) == UUID16_SVC_DEVICE_INFORMATION );
+  TEST_ASSERT( _added_svcs[1].type == 0 );
+
+  const struct ble_gatt_chr_def* chr = _added_svcs[0].characteristics;
+  uint8_t count = 0;
+
+  for (uint8_t i=0; i<arrcount(cfg_str); i++)
+  {
+    bool present = (cfg_str[i] != NULL);
+
+#if MYNEWT_VAL(BLEDIS_CFG)
+    present = true;
+#elif MYNEWT_VAL(BLEDIS_SERIAL_DYNAMIC)
+    if ( cfg_uuid[i] == UUID16_CHR_SERIAL_NUMBER_STRING ) present = true;
+#endif
+
+    if ( !present ) continue;
+
+    TEST_ASSERT_FATAL( chr[count].uuid != NULL );
+    TEST_ASSERT( ble_uuid_u16(chr[count].uuid) == cfg_uuid[i] );
+    TEST_ASSERT( (uintptr_t) chr[count].arg == i );
+    TEST_ASSERT( chr[count].access_cb != NULL );
+    TEST_ASSERT( chr[count].flags == BLE_GATT_CHR_F_READ );
+    count++;
+  }
+
+  /* Unconfigured strings leave no gap, the table ends right after */
+  TEST_ASSERT( chr[count].uuid == NULL );
+}
@@ -0,0 +1,7 @@
+#ifndef TEST_BLEDIS_H
+#define TEST_BLEDIS_H
+
+TEST_CASE_DECL(test_bledis_zero_heap);
+TEST_CASE_DECL(test_bledis_chars);
+
+#endif /* TEST_BLEDIS_H */
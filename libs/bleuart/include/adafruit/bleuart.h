@@ -41,6 +41,8 @@
 /* Configuration is done by syscfg.yml in application folder
  * - BLEUART_BUFSIZE: Size of RXD fifo (default 128)
  * - BLEUART_CLI    : Enable the use of shell to send/receive bleuart
+ * - BLEUART_SIM    : Replace the BLE link by a simulated one (native BSP)
+ * - BLEUART_LOG    : Stream adalog to the peer (requires ADAUTIL_LOG_ASYNC)
  *------------------------------------------------------------------*/
 
 #ifdef __cplusplus
@@ -56,6 +58,8 @@ extern const ble_uuid128_t BLEUART_UUID_CHR_TXD;
 
 int  bleuart_init(void);
 void bleuart_set_conn_handle(uint16_t conn_handle);
+uint16_t bleuart_mtu(void);
+uint16_t bleuart_conn_itvl_ms(void);
 
 int bleuart_write(void const* buffer, uint32_t size);
 
@@ -72,6 +76,27 @@ static inline int bleuart_puts(const char* str)
 int bleuart_read(uint8_t* buffer, uint32_t size);
 int bleuart_getc(void);
 
+#if MYNEWT_VAL(BLEUART_SIM)
+/* Statistics of the simulated link, latency is in os ticks */
+typedef struct
+{
+  uint32_t conn_events; ///< number of simulated connection events
+  uint32_t tx_pkts;     ///< notifications delivered to the peer
+  uint32_t tx_bytes;    ///< bytes delivered to the peer
+  uint32_t txq_full;    ///< writes rejected because link buffers are full
+  uint32_t latency_sum; ///< sum of queue-to-peer latency of all packets
+  uint32_t latency_max; ///< worst queue-to-peer latency
+  uint16_t crc;         ///< CRC16-CCITT of all bytes received by the peer
+} bleuart_sim_stats_t;
+
+void bleuart_sim_stats_get(bleuart_sim_stats_t* stats);
+void bleuart_sim_stats_reset(void);
+#endif
+
+#if MYNEWT_VAL(BLEUART_LOG)
+uint32_t bleuart_log_dropped(void);
+#endif
+
 #ifdef __cplusplus
  }
 #endif
@@ -38,6 +38,7 @@
 
 #include <shell/shell.h>
 #include "adafruit/bleuart.h"
+#include "adafruit/ada_gatt.h"
 #include "adafruit/fifo.h"
 
 /*------------------------------------------------------------------*/
@@ -92,7 +93,16 @@ FIFO_DEF(bleuart_ffin, MYNEWT_VAL(BLEUART_BUFSIZE), char, true, NULL);
 //FIFO_DEF(bleuart_ffout, MYNEWT_VAL(BLEUART_BUFSIZE), char, true );
 //uint8_t bleuart_xact_buf[64];
 
-int bleuart_char_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
+static void bleuart_rxd_write(uint16_t conn_handle, struct os_mbuf* om);
+
+#if MYNEWT_VAL(BLEUART_SIM)
+int bleuart_sim_init(void);
+int bleuart_sim_notify(struct os_mbuf* om);
+#endif
+
+#if MYNEWT_VAL(BLEUART_LOG)
+int bleuart_log_init(void);
+#endif
 
 static struct
 {
@@ -100,31 +110,24 @@ static struct
   uint16_t txd_hdl;
 }_bleuart;
 
-static const struct ble_gatt_svc_def _service_bleuart[] =
+static const adagatt_chr_t _bleuart_chr[] =
 {
-  {
-      .type            = BLE_GATT_SVC_TYPE_PRIMARY,
-      .uuid            = &BLEUART_UUID_SERVICE.u,
-      .characteristics = (struct ble_gatt_chr_def[])
-      {
-        { /*** Characteristic: TXD */
-          .uuid       = &BLEUART_UUID_CHR_TXD.u,
-          .val_handle = &_bleuart.txd_hdl,
-          .access_cb  = bleuart_char_access,
-          .flags      = BLE_GATT_CHR_F_NOTIFY,
-        },
-        { /*** Characteristic: RXD. */
-          .uuid       = &BLEUART_UUID_CHR_RXD.u,
-          .access_cb  = bleuart_char_access,
-          .flags      = BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP,
-        },
-        { 0 } /* No more characteristics. */
-      }
-  }
-
-  , { 0 } /* No more services. */
+  { /*** Characteristic: TXD */
+    .name       = "txd",
+    .uuid       = &BLEUART_UUID_CHR_TXD.u,
+    .flags      = BLE_GATT_CHR_F_NOTIFY,
+    .val_handle = &_bleuart.txd_hdl,
+  },
+  { /*** Characteristic: RXD, data goes to fifo rather than a value buffer */
+    .name       = "rxd",
+    .uuid       = &BLEUART_UUID_CHR_RXD.u,
+    .flags      = BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP,
+    .on_write   = bleuart_rxd_write,
+  },
 };
 
+ADAGATT_SERVICE_DEF(_service_bleuart, "ble_uart_gatt", &BLEUART_UUID_SERVICE.u, _bleuart_chr);
+
 /**
  *
  * @param cfg
@@ -144,8 +147,15 @@ int bleuart_init(void)
   stats_register("ble_uart", STATS_HDR(g_bleuart_stats));
 #endif
 
-  VERIFY_STATUS( ble_gatts_count_cfg(_service_bleuart) );
-  VERIFY_STATUS( ble_gatts_add_svcs(_service_bleuart) );
+  VERIFY_STATUS( adagatt_register(&_service_bleuart) );
+
+#if MYNEWT_VAL(BLEUART_SIM)
+  VERIFY_STATUS( bleuart_sim_init() );
+#endif
+
+#if MYNEWT_VAL(BLEUART_LOG)
+  VERIFY_STATUS( bleuart_log_init() );
+#endif
 
 #if MYNEWT_VAL(BLEUART_CLI)
   int bleuart_shell_register(void);
@@ -164,6 +174,36 @@ void bleuart_set_conn_handle(uint16_t conn_handle)
   _bleuart.conn_hdl = conn_handle;
 }
 
+/**
+ * Get ATT MTU of current connection
+ * @return MTU, or 0 if not connected
+ */
+uint16_t bleuart_mtu(void)
+{
+#if MYNEWT_VAL(BLEUART_SIM)
+  return MYNEWT_VAL(BLEUART_SIM_MTU);
+#else
+  return ble_att_mtu(_bleuart.conn_hdl);
+#endif
+}
+
+/**
+ * Get connection interval of current connection
+ * @return interval in ms, or 0 if not connected
+ */
+uint16_t bleuart_conn_itvl_ms(void)
+{
+#if MYNEWT_VAL(BLEUART_SIM)
+  return MYNEWT_VAL(BLEUART_SIM_CONN_ITVL_MS);
+#else
+  struct ble_gap_conn_desc desc;
+  if ( 0 != ble_gap_conn_find(_bleuart.conn_hdl, &desc) ) return 0;
+
+  /* 1.25 ms unit */
+  return (desc.conn_itvl * 5) / 4;
+#endif
+}
+
 /**
  *
  * @param buffer
@@ -174,11 +214,22 @@ int bleuart_write(void const* buffer, uint32_t size)
 {
   struct os_mbuf *om = ble_hs_mbuf_from_flat(buffer, size);
 
+  /* Out of mbufs, caller should retry later. Passing a NULL mbuf to
+   * ble_gattc_notify_custom() would send the attribute value instead */
+  if ( om == NULL ) return 0;
+
+  /* om is consumed by the stack even on failure */
+#if MYNEWT_VAL(BLEUART_SIM)
+  if ( 0 != bleuart_sim_notify(om) ) return 0;
+#else
+  if ( 0 != ble_gattc_notify_custom(_bleuart.conn_hdl, _bleuart.txd_hdl, om) ) return 0;
+#endif
+
 #if MYNEWT_VAL(BLEUART_STATS)
   STATS_INCN(g_bleuart_stats, txd_bytes, size);
 #endif
 
-  return (0 == ble_gattc_notify_custom(_bleuart.conn_hdl, _bleuart.txd_hdl, om)) ? size : 0;
+  return size;
 }
 
 /**
@@ -204,26 +255,19 @@ int bleuart_getc(void)
 
 
 /**
- *
+ * RXD written by peer
  * @param conn_handle
- * @param attr_handle
- * @param ctxt
- * @param arg
- * @return
+ * @param om
  */
-int bleuart_char_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+static void bleuart_rxd_write(uint16_t conn_handle, struct os_mbuf* om)
 {
-  struct os_mbuf *om = ctxt->om;
-
-  if( ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR ) return -1;
+  (void) conn_handle;
 
   fifo_write_n(bleuart_ffin, om->om_data, om->om_len);
 
 #if MYNEWT_VAL(BLEUART_STATS)
   STATS_INCN(g_bleuart_stats, rxd_bytes, om->om_len);
 #endif
-
-  return 0;
 }
 
 /*------------------------------------------------------------------*/
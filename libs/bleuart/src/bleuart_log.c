@@ -0,0 +1,263 @@
+/**************************************************************************/
+/*!
+    @file     bleuart_log.c
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2016, Adafruit Industries (adafruit.com)
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/**************************************************************************/
+
+#include "adafruit/bleuart.h"
+
+#if MYNEWT_VAL(BLEUART_LOG)
+
+#if !MYNEWT_VAL(ADAUTIL_LOG_ASYNC)
+#error "BLEUART_LOG requires ADAUTIL_LOG_ASYNC"
+#endif
+
+#include <string.h>
+#include "adafruit/ada_log.h"
+
+/*------------------------------------------------------------------*/
+/* MACRO CONSTANT TYPEDEF
+ *------------------------------------------------------------------*/
+/* adalog sink streaming the log to the peer over the TXD characteristic.
+ * Output is packed into full MTU notifications, a partial one is only sent
+ * once the log queue is empty. A token bucket in bytes, refilled at
+ * BLEUART_LOG_SHARE_PCT of the link throughput (MTU payload x packets per
+ * connection event / connection interval), decides when a notification may
+ * go out. Data that does not fit while the bucket is empty is dropped so
+ * that logging never steals more than its share from the application.
+ */
+#if MYNEWT_VAL(BLEUART_SIM)
+  #define LOG_BUFSIZE   (MYNEWT_VAL(BLEUART_SIM_MTU) - 3)
+#else
+  #define LOG_BUFSIZE   (MYNEWT_VAL(BLE_ATT_PREFERRED_MTU) - 3)
+#endif
+
+/*------------------------------------------------------------------*/
+/* VARIABLE DECLARATION
+ *------------------------------------------------------------------*/
+static void log_sink_write(const char* data, uint16_t len, void* arg);
+static void log_sink_flush(void* arg);
+
+static struct
+{
+  adalog_sink_t sink;
+  struct os_mutex mutex;
+  struct os_callout retry;
+
+  uint8_t  buf[LOG_BUFSIZE];
+  uint16_t count;
+
+  uint32_t tokens; ///< in 1/1000 byte
+  os_time_t last_tick;
+
+  uint32_t dropped;
+}_log =
+{
+  .sink = { .write = log_sink_write, .flush = log_sink_flush }
+};
+
+/*------------------------------------------------------------------*/
+/* FUNCTION DECLARATION
+ *------------------------------------------------------------------*/
+
+/**
+ * Share of the link throughput given to the log
+ * @param payload notification payload
+ * @return rate in bytes per second, 0 if not connected
+ */
+static uint32_t log_rate(uint16_t payload)
+{
+  uint16_t const itvl_ms = bleuart_conn_itvl_ms();
+  if ( itvl_ms == 0 ) return 0;
+
+  return (payload * MYNEWT_VAL(BLEUART_LOG_PKTS_PER_EVENT) * 10UL * MYNEWT_VAL(BLEUART_LOG_SHARE_PCT)) / itvl_ms;
+}
+
+/**
+ * Add tokens for the time elapsed since the last refill
+ * @param rate  bytes per second
+ * @param cap   bucket size in bytes
+ */
+static void log_refill(uint32_t rate, uint16_t cap)
+{
+  os_time_t const now = os_time_get();
+  uint64_t const tokens = _log.tokens + ((uint64_t) rate * (now - _log.last_tick) * 1000) / OS_TICKS_PER_SEC;
+
+  _log.last_tick = now;
+  _log.tokens    = (tokens < cap * 1000UL) ? (uint32_t) tokens : cap * 1000UL;
+}
+
+/**
+ * Send the pending notification if the bucket allows it, otherwise retry
+ * once enough tokens are available. Must be called with mutex held.
+ */
+static void log_send(void)
+{
+  if ( _log.count == 0 ) return;
+
+  uint16_t const mtu = bleuart_mtu();
+  uint32_t const rate = mtu ? log_rate(mtu-3) : 0;
+
+  /* Peer is gone */
+  if ( rate == 0 )
+  {
+    _log.dropped += _log.count;
+    _log.count = 0;
+    return;
+  }
+
+  log_refill(rate, max16(MYNEWT_VAL(BLEUART_LOG_BURST), mtu-3));
+
+  uint32_t const need = _log.count * 1000UL;
+
+  if ( _log.tokens >= need )
+  {
+    if ( _log.count == bleuart_write(_log.buf, _log.count) )
+    {
+      _log.tokens -= need;
+      _log.count   = 0;
+      return;
+    }
+
+    /* Out of mbufs, try again on next connection event */
+    os_callout_reset(&_log.retry, max32(1, (bleuart_conn_itvl_ms() * OS_TICKS_PER_SEC) / 1000));
+  }else
+  {
+    uint64_t const ticks = ((uint64_t) (need - _log.tokens) * OS_TICKS_PER_SEC + rate*1000UL - 1) / (rate*1000UL);
+    os_callout_reset(&_log.retry, max32(1, (uint32_t) ticks));
+  }
+}
+
+/**
+ * Retry callout, flush what the log task left behind
+ * @param ev
+ */
+static void log_retry_cb(struct os_event* ev)
+{
+  (void) ev;
+
+  os_mutex_pend(&_log.mutex, OS_TIMEOUT_NEVER);
+  log_send();
+  os_mutex_release(&_log.mutex);
+}
+
+/**
+ * Sink write, called in log task. Append to the pending notification and
+ * send it whenever it is full.
+ * @param data
+ * @param len
+ * @param arg
+ */
+static void log_sink_write(const char* data, uint16_t len, void* arg)
+{
+  (void) arg;
+
+  uint16_t const mtu = bleuart_mtu();
+
+  if ( mtu == 0 )
+  {
+    _log.dropped += len;
+    return;
+  }
+
+  uint16_t const payload = min16(mtu-3, LOG_BUFSIZE);
+
+  os_mutex_pend(&_log.mutex, OS_TIMEOUT_NEVER);
+
+  while ( len )
+  {
+    if ( _log.count >= payload )
+    {
+      log_send();
+
+      /* Bucket is empty, drop the rest rather than waiting */
+      if ( _log.count )
+      {
+        _log.dropped += len;
+        break;
+      }
+    }
+
+    uint16_t const n = min16(len, payload - _log.count);
+    memcpy(_log.buf + _log.count, data, n);
+
+    _log.count += n;
+    data       += n;
+    len        -= n;
+  }
+
+  os_mutex_release(&_log.mutex);
+}
+
+/**
+ * Sink flush, log queue is empty: send the partial notification
+ * @param arg
+ */
+static void log_sink_flush(void* arg)
+{
+  (void) arg;
+
+  os_mutex_pend(&_log.mutex, OS_TIMEOUT_NEVER);
+  log_send();
+  os_mutex_release(&_log.mutex);
+}
+
+/**
+ * Register the log sink, called by bleuart_init()
+ * @return
+ */
+int bleuart_log_init(void)
+{
+  VERIFY_STATUS( os_mutex_init(&_log.mutex) );
+  os_callout_init(&_log.retry, os_eventq_dflt_get(), log_retry_cb, NULL);
+
+  _log.count     = 0;
+  _log.tokens    = 0;
+  _log.dropped   = 0;
+  _log.last_tick = os_time_get();
+
+  adalog_add_sink(&_log.sink);
+
+  return 0;
+}
+
+/**
+ * Number of log bytes dropped because the peer was not connected or the
+ * log was over its share of the link
+ * @return
+ */
+uint32_t bleuart_log_dropped(void)
+{
+  return _log.dropped;
+}
+
+#endif
@@ -0,0 +1,184 @@
+/**************************************************************************/
+/*!
+    @file     bleuart_sim.c
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2016, Adafruit Industries (adafruit.com)
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/**************************************************************************/
+
+#include "adafruit/bleuart.h"
+
+#if MYNEWT_VAL(BLEUART_SIM)
+
+#include "adafruit/fifo.h"
+#include "crc/crc16.h"
+
+/*------------------------------------------------------------------*/
+/* MACRO CONSTANT TYPEDEF
+ *------------------------------------------------------------------*/
+/* Simulated BLE link used to run bleuart off-target (e.g native BSP).
+ * Notifications are queued instead of being sent to the controller, and
+ * a callout emulating connection events drains up to
+ * BLEUART_SIM_PKTS_PER_EVENT packets every BLEUART_SIM_CONN_ITVL_MS.
+ * The queue depth models the controller/mbuf buffering, when it is full
+ * bleuart_write() fails exactly like when the real stack is out of mbufs.
+ */
+typedef struct
+{
+  struct os_mbuf* om;
+  os_time_t       enq_tick;
+} sim_pkt_t;
+
+/*------------------------------------------------------------------*/
+/* VARIABLE DECLARATION
+ *------------------------------------------------------------------*/
+static struct os_mutex _sim_mutex;
+FIFO_DEF(_sim_txq, MYNEWT_VAL(BLEUART_SIM_TXQ_DEPTH), sim_pkt_t, false, &_sim_mutex);
+
+static struct
+{
+  struct os_callout conn_event;
+  uint32_t itvl_ticks;
+
+  bleuart_sim_stats_t stats;
+}_sim;
+
+/*------------------------------------------------------------------*/
+/* FUNCTION DECLARATION
+ *------------------------------------------------------------------*/
+
+/**
+ * Connection event: deliver up to budget packets to the simulated peer
+ * @param ev
+ */
+static void sim_conn_event_cb(struct os_event *ev)
+{
+  (void) ev;
+
+  uint16_t const payload = MYNEWT_VAL(BLEUART_SIM_MTU) - 3;
+  os_time_t const now    = os_time_get();
+  sim_pkt_t pkt;
+
+  _sim.stats.conn_events++;
+
+  for(uint16_t i=0; i < MYNEWT_VAL(BLEUART_SIM_PKTS_PER_EVENT) && fifo_read(_sim_txq, &pkt); i++)
+  {
+    /* Peer only gets what fits into one notification */
+    uint16_t len = min16(OS_MBUF_PKTLEN(pkt.om), payload);
+
+    /* Peer side checksum, matches the one computed by the sender */
+    for(struct os_mbuf* m = pkt.om; m && len; m = SLIST_NEXT(m, om_next))
+    {
+      uint16_t const n = min16(m->om_len, len);
+
+      _sim.stats.crc = crc16_ccitt(_sim.stats.crc, m->om_data, n);
+      len -= n;
+      _sim.stats.tx_bytes += n;
+    }
+
+    os_time_t const latency = now - pkt.enq_tick;
+
+    _sim.stats.tx_pkts++;
+    _sim.stats.latency_sum += latency;
+    _sim.stats.latency_max  = max32(_sim.stats.latency_max, latency);
+
+    os_mbuf_free_chain(pkt.om);
+  }
+
+  os_callout_reset(&_sim.conn_event, _sim.itvl_ticks);
+}
+
+/**
+ * Initialize the simulated link, called by bleuart_init()
+ * @return
+ */
+int bleuart_sim_init(void)
+{
+  uint32_t ticks;
+
+  VERIFY_STATUS( os_mutex_init(&_sim_mutex) );
+  VERIFY_STATUS( os_time_ms_to_ticks(MYNEWT_VAL(BLEUART_SIM_CONN_ITVL_MS), &ticks) );
+
+  _sim.itvl_ticks = max32(1, ticks);
+
+  bleuart_sim_stats_reset();
+
+  os_callout_init(&_sim.conn_event, os_eventq_dflt_get(), sim_conn_event_cb, NULL);
+  os_callout_reset(&_sim.conn_event, _sim.itvl_ticks);
+
+  return 0;
+}
+
+/**
+ * Queue a notification to the simulated link, om is always consumed
+ * @param om
+ * @return 0 if queued, BLE_HS_ENOMEM if the link buffers are full
+ */
+int bleuart_sim_notify(struct os_mbuf* om)
+{
+  sim_pkt_t const pkt = { .om = om, .enq_tick = os_time_get() };
+
+  if ( !fifo_write(_sim_txq, &pkt) )
+  {
+    _sim.stats.txq_full++;
+    os_mbuf_free_chain(om);
+    return BLE_HS_ENOMEM;
+  }
+
+  return 0;
+}
+
+/**
+ * Get the simulated link statistics
+ * @param stats
+ */
+void bleuart_sim_stats_get(bleuart_sim_stats_t* stats)
+{
+  os_sr_t sr;
+
+  OS_ENTER_CRITICAL(sr);
+  (*stats) = _sim.stats;
+  OS_EXIT_CRITICAL(sr);
+}
+
+/**
+ * Reset the simulated link statistics, including the peer checksum
+ */
+void bleuart_sim_stats_reset(void)
+{
+  os_sr_t sr;
+
+  OS_ENTER_CRITICAL(sr);
+  varclr(_sim.stats);
+  _sim.stats.crc = CRC16_INITIAL_CRC;
+  OS_EXIT_CRITICAL(sr);
+}
+
+#endif
@@ -37,6 +37,9 @@
 #ifndef __ORIENTATION_H__
 #define __ORIENTATION_H__
 
+#include <stdbool.h>
+#include "os/os.h"
+#include "syscfg/syscfg.h"
 #include "sensor/sensor.h"
 #include "sensor/accel.h"
 #include "sensor/mag.h"
@@ -51,12 +54,170 @@ struct or_orientation_vec {
     float heading;
 } __attribute__((packed));
 
+/* Fixed-point orientation, angles are binary angles: 32768 == 180 degree */
+struct or_orientation_q15 {
+    int16_t roll;
+    int16_t pitch;
+    int16_t heading;
+};
+
+#define OR_Q15_TO_DEG(_q15)     ((_q15) * (180.0F / 32768))
+
+/* Block of samples as structure of arrays, e.g drained from a sensor FIFO */
+struct or_vec3_soa {
+    const float *x;
+    const float *y;
+    const float *z;
+};
+
+struct or_orientation_soa {
+    float *roll;
+    float *pitch;
+    float *heading;
+};
+
+/* Unit quaternion, rotation from sensor frame to earth frame */
+struct or_quat {
+    float w;
+    float x;
+    float y;
+    float z;
+};
+
+/* Same in Q30 (1 << 30 == 1.0) */
+struct or_quat_q30 {
+    int32_t w;
+    int32_t x;
+    int32_t y;
+    int32_t z;
+};
+
+/* Magnetometer calibration: calibrated = softiron * (raw - offset).
+ * offset is the hard-iron offset, softiron maps the ellipsoid of raw
+ * readings back to a sphere of the same volume */
+struct or_magcal_params {
+    float offset[3];
+    float softiron[3][3];
+};
+
+/* Online calibration, collects well spread samples and fits them, see
+ * orientation_magcal.c */
+struct or_magcal {
+    float samples[MYNEWT_VAL(ORIENTATION_MAGCAL_SAMPLES)][3];
+    uint16_t count;
+    uint16_t fresh;     /* samples kept since the last or_magcal_fit() */
+    float min[3];       /* bounding box of all samples */
+    float max[3];
+    float fit_err;      /* rms distance to the sphere of params, relative */
+    struct or_magcal_params params;
+};
+
+/* Mahony complementary filter state, see orientation_fusion.c */
+struct or_fusion {
+    struct or_quat q;
+    float kp2;          /* 2 * proportional gain */
+    float ki2;          /* 2 * integral gain */
+    float bias[3];      /* integral feedback, gyro bias estimate in rad/s */
+};
+
+/* Fixed-point filter, fixed update period. Constants are pre-multiplied by
+ * the period, see orientation_fusion_q30.c */
+struct or_fusion_q30 {
+    struct or_quat_q30 q;
+    int32_t kp_dt;      /* Q30, kp * dt */
+    int32_t ki_dt2;     /* Q30, ki * dt^2 */
+    int32_t gyro_k;     /* raw gyro to half angle per update, Q(30 + shift) */
+    uint8_t gyro_shift;
+    float dt;
+    int32_t bias[3];    /* integral feedback, half angle per update in Q30 */
+};
+
+/* Filter types for or_filter_init() */
+#define OR_FILTER_NONE          0
+#define OR_FILTER_LOWPASS       1
+#define OR_FILTER_AVERAGE       2
+#define OR_FILTER_MEDIAN        3
+
+/* Output filter and decimator, angles as binary angles (2^32 == 360
+ * degree), see orientation_filter.c */
+struct or_filter {
+    uint8_t type;
+    uint8_t len;        /* window length, average and median */
+    uint8_t count;      /* samples in the window */
+    uint8_t head;       /* next write position in buf */
+    uint16_t decim;
+    uint16_t phase;     /* samples since the last output */
+    int32_t alpha;      /* low-pass gain, Q16 */
+    uint32_t state[3];  /* low-pass output */
+    uint32_t buf[MYNEWT_VAL(ORIENTATION_FILTER_LEN)][3];
+};
+
+/* Latest orientation published by or_stream_start() */
+struct or_stream_sample {
+    struct or_orientation_vec orv;
+    os_time_t ts;       /* os_time_get() when the accelerometer was read */
+    uint32_t seq;       /* increments with each sample, 0 before the first */
+};
+
 int or_from_accel(struct sensor_accel_data*,
     struct or_orientation_vec*);
 int or_from_accel_mag(struct sensor_accel_data*,
     struct sensor_mag_data*,
     struct or_orientation_vec*);
 
+int or_from_accel_q15(int16_t const accel[3], struct or_orientation_q15*);
+int or_from_accel_mag_q15(int16_t const accel[3], int16_t const mag[3],
+    struct or_orientation_q15*);
+
+int or_from_accel_batch(const struct or_vec3_soa *accel,
+    struct or_orientation_soa *orv, uint32_t count);
+int or_from_accel_mag_batch(const struct or_vec3_soa *accel,
+    const struct or_vec3_soa *mag, struct or_orientation_soa *orv,
+    uint32_t count);
+
+int or_fusion_init(struct or_fusion *f, float kp, float ki);
+int or_fusion_align(struct or_fusion *f, float const accel[3],
+    float const mag[3]);
+int or_fusion_set_gains(struct or_fusion *f, float kp, float ki);
+int or_fusion_update(struct or_fusion *f, float const gyro[3],
+    float const accel[3], float const mag[3], float dt);
+int or_fusion_euler(struct or_fusion const *f, struct or_orientation_vec *orv);
+
+int or_fusion_q30_init(struct or_fusion_q30 *f, float kp, float ki,
+    float gyro_lsb, float dt);
+int or_fusion_q30_align(struct or_fusion_q30 *f, int16_t const accel[3],
+    int16_t const mag[3]);
+int or_fusion_q30_set_gains(struct or_fusion_q30 *f, float kp, float ki);
+int or_fusion_q30_update(struct or_fusion_q30 *f, int16_t const gyro[3],
+    int16_t const accel[3], int16_t const mag[3]);
+int or_fusion_q30_euler(struct or_fusion_q30 const *f,
+    struct or_orientation_q15 *orv);
+
+int or_magcal_init(struct or_magcal *cal);
+bool or_magcal_add(struct or_magcal *cal, struct sensor_mag_data const *mag);
+int or_magcal_fit(struct or_magcal *cal);
+void or_magcal_apply(struct or_magcal_params const *p,
+    struct sensor_mag_data *mag);
+int or_magcal_set(struct or_magcal_params const *p);
+struct or_magcal_params const *or_magcal_get(void);
+int or_magcal_save(void);
+
+int or_filter_init(struct or_filter *f, uint8_t type, uint8_t len,
+    float alpha, uint16_t decim);
+void or_filter_reset(struct or_filter *f);
+bool or_filter_update(struct or_filter *f, struct or_orientation_vec const *in,
+    struct or_orientation_vec *out);
+bool or_filter_update_q15(struct or_filter *f,
+    struct or_orientation_q15 const *in, struct or_orientation_q15 *out);
+
+int or_stream_start(char *devname, uint32_t rate_ms);
+int or_stream_stop(void);
+int or_stream_get(struct or_stream_sample *sample);
+
+void orientation_pkg_init(void);
+
+float or_atan2f(float y, float x);
+
 #ifdef __cplusplus
  }
 #endif
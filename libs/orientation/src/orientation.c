@@ -34,25 +34,62 @@
 */
 /*****************************************************************************/
 #include <math.h>
+#include "syscfg/syscfg.h"
 #include "orientation/orientation.h"
+#include "orientation_priv.h"
+
+#define OR_PI           3.14159265F
+#define OR_RAD_TO_DEG   (180.0F / OR_PI)
+
+/* Kernels below are branch-free (conditionals are selects) and inlined in
+ * both the single sample and the batch functions, so that both give the same
+ * results and the batch loops can be unrolled/vectorized by the compiler. */
+
+#if MYNEWT_VAL(ORIENTATION_FAST_MATH)
+/* Single-precision atan2 using the Abramowitz & Stegun 4.4.49 polynomial on
+ * [0, 1] after octant reduction. Absolute error <= 1e-5 rad (0.0006 degree),
+ * no call into libm. Returns 0 when x == y == 0. */
+static inline float
+or_atan2f_inline(float y, float x)
+{
+    float const ax = fabsf(x);
+    float const ay = fabsf(y);
+    float const mx = ax > ay ? ax : ay;
+    float const mn = ax > ay ? ay : ax;
+
+    float const t  = mn / (mx > 0.0F ? mx : 1.0F);
+    float const t2 = t * t;
+    float a = t * (0.9998660F + t2 * (-0.3302995F + t2 * (0.1801410F +
+              t2 * (-0.0851330F + t2 * 0.0208351F))));
+
+    a = ay > ax ? (OR_PI / 2) - a : a;
+    a = x < 0 ? OR_PI - a : a;
+
+    return y < 0 ? -a : a;
+}
+#else
+  #define or_atan2f_inline    atan2f
+#endif
 
 /**
- * Populates the .pitch/.roll fields in the or_orientation_vec struct
- * with the right angular data (in degree)
+ * atan2 used by the orientation functions, see ORIENTATION_FAST_MATH
  *
- * @param  The sensors_event_t variable containing the data from the
- *         accelerometer
- * @param  The or_orientation_vec object that will have it's .pitch and
- *         .roll fields populated
+ * @param  y
+ * @param  x
  *
- * @return 0 on success, non-zero on failure
+ * @return angle in radian, -pi..pi
  */
-int
-or_from_accel(struct sensor_accel_data *accel, struct or_orientation_vec *orv)
+float
+or_atan2f(float y, float x)
 {
-  float t_pitch, t_roll;
-  float const PI = 3.14159265F;
-  float signOfZ = accel->sad_z >= 0 ? 1.0F : -1.0F;
+    return or_atan2f_inline(y, x);
+}
+
+/* Roll and pitch in degree from accelerometer, see or_from_accel() */
+static inline void
+or_accel_kernel(float x, float y, float z, float *roll, float *pitch)
+{
+  float signOfZ = z >= 0 ? 1.0F : -1.0F;
 
   /* roll: Rotation around the longitudinal axis (the plane body, 'X axis'). */
   /* -90<=roll<=90                                                           */
@@ -63,8 +100,7 @@ or_from_accel(struct sensor_accel_data *accel, struct or_orientation_vec *orv)
   /*                          sqrt(x^2 + z^2)                                */
   /* where:  x, y, z are returned value from accelerometer sensor            */
 
-  t_roll = accel->sad_x * accel->sad_x + accel->sad_z * accel->sad_z;
-  orv->roll = (float)atan2(accel->sad_y, sqrt(t_roll)) * 180 / PI;
+  *roll = or_atan2f_inline(y, sqrtf(x * x + z * z)) * OR_RAD_TO_DEG;
 
   /* pitch: Rotation around the lateral axis (the wing span, 'Y axis').      */
   /* -180<=pitch<=180)                                                       */
@@ -75,40 +111,16 @@ or_from_accel(struct sensor_accel_data *accel, struct or_orientation_vec *orv)
   /*                          sqrt(y^2 + z^2)                                */
   /* where:  x, y, z are returned value from accelerometer sensor            */
 
-  t_pitch = accel->sad_y * accel->sad_y + accel->sad_z * accel->sad_z;
-  orv->pitch = (float)atan2(accel->sad_x, signOfZ * sqrt(t_pitch)) * 180 / PI;
-
-  orv->heading = 0.0F;
-
-  return (0);
+  *pitch = or_atan2f_inline(x, signOfZ * sqrtf(y * y + z * z)) * OR_RAD_TO_DEG;
 }
 
-/**
- * Populates the .roll/.pitch/.heading fields in the or_orientation_vec
- * struct with the right angular data (in degree).
- *
- * The starting position is set by placing the object flat and pointing
- * northwards (Z-axis pointing upward and X-axis pointing northwards).
- *
- * The orientation of the object can be modeled as resulting from 3
- * consecutive rotations in turn: heading (Z-axis), pitch (Y-axis), and roll
- * (X-axis) applied to the starting position.
- *
- * @param  The sensors_accel_data variable containing the data from the
- *         accelerometer
- * @param  The sensors_mag_data variable containing the data from the
- *         magnetometer
- * @param  The or_orientation_vec field that will have it's .roll, .pitch and
- *         .heading values populated
- *
- * @return 0 on success, non-zero on failure
- */
-int
-or_from_accel_mag(struct sensor_accel_data *accel, struct sensor_mag_data *mag,
-    struct or_orientation_vec *orv)
+/* Roll, pitch and heading in degree, see or_from_accel_mag().
+ * Sine and cosine of roll and pitch are never evaluated, they are the
+ * ratios of the accelerometer components the angles are computed from. */
+static inline void
+or_accel_mag_kernel(float x, float y, float z, float mx, float my, float mz,
+    float *roll, float *pitch, float *heading)
 {
-    float const PI = 3.14159265F;
-
     /* roll: Rotation around the X-axis. -180 <= roll <= 180                */
     /* a positive roll angle is defined to be a clockwise rotation about    */
     /* the positive X-axis                                                  */
@@ -118,7 +130,17 @@ or_from_accel_mag(struct sensor_accel_data *accel, struct sensor_mag_data *mag,
     /*                    z                                                 */
     /*                                                                      */
     /* where:  y, z are returned value from accelerometer sensor            */
-    orv->roll = (float)atan2(accel->sad_y, accel->sad_z);
+    /* hence sin(roll) = y / sqrt(y^2 + z^2), cos(roll) = z / sqrt(y^2 + z^2) */
+    float const yz  = sqrtf(y * y + z * z);
+    float const xyz = sqrtf(x * x + yz * yz);
+
+    /* Flat on its side (y = z = 0): roll is 0, pitch +/-90 */
+    float const inv_yz  = yz  > 0 ? 1.0F / yz  : 0.0F;
+    float const inv_xyz = xyz > 0 ? 1.0F / xyz : 0.0F;
+    float const x_sign  = x > 0 ? 1.0F : -1.0F;
+
+    float const sin_roll = y * inv_yz;
+    float const cos_roll = yz > 0 ? z * inv_yz : 1.0F;
 
     /* pitch: Rotation around the Y-axis. -180 <= roll <= 180               */
     /* a positive pitch angle is defined to be a clockwise rotation about   */
@@ -129,13 +151,10 @@ or_from_accel_mag(struct sensor_accel_data *accel, struct sensor_mag_data *mag,
     /*                    y * sin(roll) + z * cos(roll)                     */
     /*                                                                      */
     /* where:  x, y, z are returned value from accelerometer sensor         */
-    if (accel->sad_y * sin(orv->roll) + accel->sad_z * cos(orv->roll) == 0) {
-        orv->pitch = accel->sad_x > 0 ? (PI / 2) : (-PI / 2);
-    } else {
-        orv->pitch = (float)atan(-accel->sad_x / (accel->sad_y *
-            sin(orv->roll) +
-            accel->sad_z * cos(orv->roll)));
-    }
+    /* the denominator is sqrt(y^2 + z^2), never negative                   */
+    float const p = yz > 0 ? or_atan2f_inline(-x, yz) : x_sign * (OR_PI / 2);
+    float const sin_pitch = yz > 0 ? -x * inv_xyz : x_sign;
+    float const cos_pitch = yz * inv_xyz;
 
     /* heading: Rotation around the Z-axis. -180 <= roll <= 180             */
     /* a positive heading angle is defined to be a clockwise rotation about */
@@ -147,16 +166,148 @@ or_from_accel_mag(struct sensor_accel_data *accel, struct sensor_mag_data *mag,
     /*                             z * sin(pitch) * cos(roll))              */
     /*                                                                      */
     /* where:  x, y, z are returned value from magnetometer sensor          */
-    orv->heading = (float)atan2(mag->smd_z * sin(orv->roll) -
-        mag->smd_y * cos(orv->roll),
-        mag->smd_x * cos(orv->pitch) +
-        mag->smd_y * sin(orv->pitch) * sin(orv->roll) +
-        mag->smd_z * sin(orv->pitch) * cos(orv->roll));
+    float const h = or_atan2f_inline(mz * sin_roll - my * cos_roll,
+        mx * cos_pitch + sin_pitch * (my * sin_roll + mz * cos_roll));
 
     /* Convert angular data to degree */
-    orv->roll = orv->roll * 180 / PI;
-    orv->pitch = orv->pitch * 180 / PI;
-    orv->heading = orv->heading * 180 / PI;
+    *roll = or_atan2f_inline(y, z) * OR_RAD_TO_DEG;
+    *pitch = p * OR_RAD_TO_DEG;
+    *heading = h * OR_RAD_TO_DEG;
+}
+
+/**
+ * Populates the .pitch/.roll fields in the or_orientation_vec struct
+ * with the right angular data (in degree)
+ *
+ * @param  The sensors_event_t variable containing the data from the
+ *         accelerometer
+ * @param  The or_orientation_vec object that will have it's .pitch and
+ *         .roll fields populated
+ *
+ * @return 0 on success, non-zero on failure
+ */
+int
+or_from_accel(struct sensor_accel_data *accel, struct or_orientation_vec *orv)
+{
+  float roll, pitch;
+
+  or_accel_kernel(accel->sad_x, accel->sad_y, accel->sad_z, &roll, &pitch);
+
+  orv->roll = roll;
+  orv->pitch = pitch;
+  orv->heading = 0.0F;
+
+  return (0);
+}
+
+/**
+ * Populates the .roll/.pitch/.heading fields in the or_orientation_vec
+ * struct with the right angular data (in degree).
+ *
+ * The starting position is set by placing the object flat and pointing
+ * northwards (Z-axis pointing upward and X-axis pointing northwards).
+ *
+ * The orientation of the object can be modeled as resulting from 3
+ * consecutive rotations in turn: heading (Z-axis), pitch (Y-axis), and roll
+ * (X-axis) applied to the starting position.
+ *
+ * @param  The sensors_accel_data variable containing the data from the
+ *         accelerometer
+ * @param  The sensors_mag_data variable containing the data from the
+ *         magnetometer
+ * @param  The or_orientation_vec field that will have it's .roll, .pitch and
+ *         .heading values populated
+ *
+ * @return 0 on success, non-zero on failure
+ */
+int
+or_from_accel_mag(struct sensor_accel_data *accel, struct sensor_mag_data *mag,
+    struct or_orientation_vec *orv)
+{
+    float roll, pitch, heading;
+    float m[3] = { mag->smd_x, mag->smd_y, mag->smd_z };
+
+#if MYNEWT_VAL(ORIENTATION_MAGCAL)
+    or_magcal_correct(or_magcal_active, m);
+#endif
+
+    or_accel_mag_kernel(accel->sad_x, accel->sad_y, accel->sad_z,
+        m[0], m[1], m[2], &roll, &pitch, &heading);
+
+    orv->roll = roll;
+    orv->pitch = pitch;
+    orv->heading = heading;
+
+    return (0);
+}
+
+/**
+ * or_from_accel() over a block of samples. Inputs and outputs are
+ * structure of arrays, a buffer filled by the sensor FIFO is converted in a
+ * single loop without per-sample call overhead. .heading is not written.
+ *
+ * @param  accel  x/y/z arrays of count samples
+ * @param  orv    roll/pitch arrays of count entries, must not overlap accel
+ * @param  count  number of samples
+ *
+ * @return 0 on success, non-zero on failure
+ */
+int
+or_from_accel_batch(const struct or_vec3_soa *accel,
+    struct or_orientation_soa *orv, uint32_t count)
+{
+    float const * __restrict ax = accel->x;
+    float const * __restrict ay = accel->y;
+    float const * __restrict az = accel->z;
+    float * __restrict roll = orv->roll;
+    float * __restrict pitch = orv->pitch;
+
+    for (uint32_t i = 0; i < count; i++) {
+        or_accel_kernel(ax[i], ay[i], az[i], &roll[i], &pitch[i]);
+    }
+
+    return (0);
+}
+
+/**
+ * or_from_accel_mag() over a block of samples, see or_from_accel_batch()
+ *
+ * @param  accel  x/y/z arrays of count samples
+ * @param  mag    x/y/z arrays of count samples
+ * @param  orv    roll/pitch/heading arrays of count entries, must not
+ *                overlap the inputs
+ * @param  count  number of samples
+ *
+ * @return 0 on success, non-zero on failure
+ */
+int
+or_from_accel_mag_batch(const struct or_vec3_soa *accel,
+    const struct or_vec3_soa *mag, struct or_orientation_soa *orv,
+    uint32_t count)
+{
+    float const * __restrict ax = accel->x;
+    float const * __restrict ay = accel->y;
+    float const * __restrict az = accel->z;
+    float const * __restrict mx = mag->x;
+    float const * __restrict my = mag->y;
+    float const * __restrict mz = mag->z;
+    float * __restrict roll = orv->roll;
+    float * __restrict pitch = orv->pitch;
+    float * __restrict heading = orv->heading;
+#if MYNEWT_VAL(ORIENTATION_MAGCAL)
+    struct or_magcal_params const *cal = or_magcal_active;
+#endif
+
+    for (uint32_t i = 0; i < count; i++) {
+        float m[3] = { mx[i], my[i], mz[i] };
+
+#if MYNEWT_VAL(ORIENTATION_MAGCAL)
+        or_magcal_correct(cal, m);
+#endif
+
+        or_accel_mag_kernel(ax[i], ay[i], az[i], m[0], m[1], m[2],
+            &roll[i], &pitch[i], &heading[i]);
+    }
 
     return (0);
 }
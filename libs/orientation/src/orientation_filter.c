@@ -0,0 +1,288 @@
+/*****************************************************************************/
+/*!
+    @file     orientation_filter.c
+    @author   ktownsend (Adafruit Industries)
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2017, Adafruit Industries (adafruit.com)
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/*****************************************************************************/
+#include <string.h>
+#include "os/os.h"
+#include "syscfg/syscfg.h"
+#include "orientation/orientation.h"
+
+/* Output filter and decimator for roll, pitch and heading.
+ *
+ * Angles are filtered as 32-bit binary angles (2^32 == 360 degree), so the
+ * wrap at +/-180 degree is the natural integer overflow and needs no trig:
+ * the difference of two angles is their wrapping difference as int32_t.
+ *
+ * - Low-pass: exponential average y += alpha * (x - y), updated for every
+ *   sample.
+ * - Moving average and median: the samples are kept in a circular buffer
+ *   and only reduced when an output is due, as offsets from the newest
+ *   sample. This assumes the window spans less than 180 degree.
+ *
+ * With a decimation of n only every n-th sample produces an output, a
+ * window at least n long avoids aliasing. */
+
+#if MYNEWT_VAL(ORIENTATION_FILTER_LEN) < 1 || MYNEWT_VAL(ORIENTATION_FILTER_LEN) > 255
+#error "ORIENTATION_FILTER_LEN must be 1..255"
+#endif
+
+#define FILTER_LEN              MYNEWT_VAL(ORIENTATION_FILTER_LEN)
+#define FILTER_DEG_TO_BAM4      (1073741824.0F / 360)   /* 2^32 / 360 / 4 */
+#define FILTER_BAM_TO_DEG       (360.0F / 4294967296.0F)
+
+/* The quarter scale keeps any angle within +/-360 degree inside int32_t */
+static inline uint32_t
+filter_from_deg(float deg)
+{
+    return (uint32_t) (int32_t) (deg * FILTER_DEG_TO_BAM4) << 2;
+}
+
+static inline float
+filter_to_deg(uint32_t a)
+{
+    return (int32_t) a * FILTER_BAM_TO_DEG;
+}
+
+static inline uint32_t
+filter_from_q15(int16_t a)
+{
+    return (uint32_t) (uint16_t) a << 16;
+}
+
+static inline int16_t
+filter_to_q15(uint32_t a)
+{
+    return (int16_t) ((a + 0x8000) >> 16);
+}
+
+static void
+filter_average(struct or_filter const *f, uint32_t const ref[3],
+    uint32_t out[3])
+{
+    int i, k;
+
+    for (i = 0; i < 3; i++) {
+        int32_t sum = 0;
+
+        /* 24 bit offsets, the sum of up to 255 fits */
+        for (k = 0; k < f->count; k++) {
+            sum += (int32_t) (f->buf[k][i] - ref[i]) >> 8;
+        }
+        out[i] = ref[i] + (uint32_t) (sum / f->count) * 256;
+    }
+}
+
+static void
+filter_median(struct or_filter const *f, uint32_t const ref[3],
+    uint32_t out[3])
+{
+    int32_t d[FILTER_LEN];
+    int32_t m;
+    int i, j, k;
+    int const n = f->count;
+
+    for (i = 0; i < 3; i++) {
+        /* Insertion sort, the window is short */
+        for (k = 0; k < n; k++) {
+            int32_t const v = (int32_t) (f->buf[k][i] - ref[i]);
+
+            for (j = k; j > 0 && d[j - 1] > v; j--) {
+                d[j] = d[j - 1];
+            }
+            d[j] = v;
+        }
+
+        m = n & 1 ? d[n / 2] : (d[n / 2 - 1] >> 1) + (d[n / 2] >> 1);
+        out[i] = ref[i] + (uint32_t) m;
+    }
+}
+
+/* Filters one sample, returns true if out was written */
+static bool
+filter_push(struct or_filter *f, uint32_t const in[3], uint32_t out[3])
+{
+    int i;
+
+    switch (f->type) {
+    case OR_FILTER_LOWPASS:
+        for (i = 0; i < 3; i++) {
+            int32_t const d = (int32_t) (in[i] - f->state[i]);
+
+            f->state[i] = f->count ? f->state[i] +
+                (uint32_t) (int32_t) (((int64_t) d * f->alpha) >> 16) : in[i];
+        }
+        f->count = 1;
+        break;
+    case OR_FILTER_AVERAGE:
+    case OR_FILTER_MEDIAN:
+        memcpy(f->buf[f->head], in, sizeof(f->buf[0]));
+        f->head = f->head + 1 < f->len ? f->head + 1 : 0;
+        if (f->count < f->len) {
+            f->count++;
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (++f->phase < f->decim) {
+        return false;
+    }
+    f->phase = 0;
+
+    switch (f->type) {
+    case OR_FILTER_LOWPASS:
+        memcpy(out, f->state, sizeof(f->state));
+        break;
+    case OR_FILTER_AVERAGE:
+        filter_average(f, in, out);
+        break;
+    case OR_FILTER_MEDIAN:
+        filter_median(f, in, out);
+        break;
+    default:
+        memcpy(out, in, sizeof(f->state));
+        break;
+    }
+
+    return true;
+}
+
+/**
+ * Initialises an orientation filter
+ *
+ * @param  f       The filter
+ * @param  type    OR_FILTER_NONE, OR_FILTER_LOWPASS, OR_FILTER_AVERAGE or
+ *                 OR_FILTER_MEDIAN
+ * @param  len     Window length for OR_FILTER_AVERAGE and OR_FILTER_MEDIAN,
+ *                 1..ORIENTATION_FILTER_LEN
+ * @param  alpha   Gain for OR_FILTER_LOWPASS, 0 < alpha <= 1. For a cutoff
+ *                 fc at sample period dt: alpha = dt / (dt + 1 / (2 pi fc))
+ * @param  decim   Output every decim-th sample, 1 for every sample
+ *
+ * @return 0 on success, OS_EINVAL if a parameter is out of range
+ */
+int
+or_filter_init(struct or_filter *f, uint8_t type, uint8_t len, float alpha,
+    uint16_t decim)
+{
+    if (type > OR_FILTER_MEDIAN || decim == 0) {
+        return (OS_EINVAL);
+    }
+    if ((type == OR_FILTER_AVERAGE || type == OR_FILTER_MEDIAN) &&
+        (len == 0 || len > FILTER_LEN)) {
+        return (OS_EINVAL);
+    }
+    if (type == OR_FILTER_LOWPASS && !(alpha > 0 && alpha <= 1)) {
+        return (OS_EINVAL);
+    }
+
+    memset(f, 0, sizeof(*f));
+    f->type = type;
+    f->len = len;
+    f->decim = decim;
+    f->alpha = (int32_t) (alpha * 65536 + 0.5F);
+
+    return (0);
+}
+
+/**
+ * Drops the filter history, e.g. after a gap in the samples
+ *
+ * @param  f       The filter
+ */
+void
+or_filter_reset(struct or_filter *f)
+{
+    f->count = 0;
+    f->head = 0;
+    f->phase = 0;
+}
+
+/**
+ * Filters one orientation sample
+ *
+ * @param  f       The filter
+ * @param  in      The sample, angles within +/-360 degree
+ * @param  out     Written when an output is due, roll, pitch and heading
+ *                 within +/-180 degree
+ *
+ * @return true if out was written, false if the sample was decimated
+ */
+bool
+or_filter_update(struct or_filter *f, struct or_orientation_vec const *in,
+    struct or_orientation_vec *out)
+{
+    uint32_t const a[3] = {
+        filter_from_deg(in->roll),
+        filter_from_deg(in->pitch),
+        filter_from_deg(in->heading)
+    };
+    uint32_t b[3];
+
+    if (!filter_push(f, a, b)) {
+        return false;
+    }
+
+    out->roll = filter_to_deg(b[0]);
+    out->pitch = filter_to_deg(b[1]);
+    out->heading = filter_to_deg(b[2]);
+
+    return true;
+}
+
+/**
+ * Same as or_filter_update() for fixed-point samples
+ */
+bool
+or_filter_update_q15(struct or_filter *f, struct or_orientation_q15 const *in,
+    struct or_orientation_q15 *out)
+{
+    uint32_t const a[3] = {
+        filter_from_q15(in->roll),
+        filter_from_q15(in->pitch),
+        filter_from_q15(in->heading)
+    };
+    uint32_t b[3];
+
+    if (!filter_push(f, a, b)) {
+        return false;
+    }
+
+    out->roll = filter_to_q15(b[0]);
+    out->pitch = filter_to_q15(b[1]);
+    out->heading = filter_to_q15(b[2]);
+
+    return true;
+}
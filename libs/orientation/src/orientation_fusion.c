@@ -0,0 +1,379 @@
+/*****************************************************************************/
+/*!
+    @file     orientation_fusion.c
+    @author   ktownsend (Adafruit Industries)
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2017, Adafruit Industries (adafruit.com)
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/*****************************************************************************/
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+#include "os/os.h"
+#include "syscfg/syscfg.h"
+#include "orientation/orientation.h"
+#include "orientation_priv.h"
+
+/* Mahony complementary filter (R. Mahony et al., "Nonlinear Complementary
+ * Filters on the Special Orthogonal Group", 2008). The gyro is integrated
+ * into the quaternion, the error between the measured and the estimated
+ * gravity (and magnetic field) directions is fed back through a PI
+ * controller. The integral term converges to the gyro bias, which removes
+ * the drift. Constant time per sample, one sqrt per normalized vector.
+ *
+ * Gyro is in rad/s, accel and mag only need consistent units, they are
+ * normalized. The earth frame has z along the accelerometer reading at rest
+ * and x along the horizontal component of the magnetic field. */
+
+#define OR_RAD_TO_DEG   (180.0F / 3.14159265F)
+
+static inline float
+or_inv_sqrt(float v)
+{
+    return 1.0F / sqrtf(v);
+}
+
+static inline void
+or_cross(float const a[3], float const b[3], float out[3])
+{
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static bool
+or_normalize(float const v[3], float out[3])
+{
+    float const n2 = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+
+    if (!(n2 > 1e-12F)) {
+        return false;
+    }
+
+    float const n = or_inv_sqrt(n2);
+
+    out[0] = v[0] * n;
+    out[1] = v[1] * n;
+    out[2] = v[2] * n;
+
+    return true;
+}
+
+/**
+ * Orientation of a single accel (+ mag) sample, TRIAD method: the rows of
+ * the rotation matrix are the earth axes in sensor frame, z along accel, y
+ * along accel x mag, then converted to a quaternion (Shepperd).
+ *
+ * @param  accel  accelerometer x, y, z
+ * @param  mag    magnetometer x, y, z, NULL for heading 0 (sensor x axis
+ *                projected on the horizontal plane)
+ * @param  q      populated on success
+ *
+ * @return 0 on success, OS_EINVAL if accel is null or parallel to mag
+ */
+int
+or_quat_align(float const accel[3], float const mag[3], struct or_quat *q)
+{
+    static float const ex[3] = { 1.0F, 0.0F, 0.0F };
+    static float const ey[3] = { 0.0F, 1.0F, 0.0F };
+    float r[3][3], t[3];
+
+    if (!or_normalize(accel, r[2])) {
+        return OS_EINVAL;
+    }
+
+    or_cross(r[2], mag ? mag : ex, t);
+
+    if (!or_normalize(t, r[1])) {
+        if (mag) {
+            return OS_EINVAL;
+        }
+
+        /* sensor x axis vertical */
+        or_cross(r[2], ey, t);
+        if (!or_normalize(t, r[1])) {
+            return OS_EINVAL;
+        }
+    }
+
+    or_cross(r[1], r[2], r[0]);
+
+    float const tr = r[0][0] + r[1][1] + r[2][2];
+    float s;
+
+    if (tr > 0) {
+        s = 2 * sqrtf(1 + tr);
+        *q = (struct or_quat) { 0.25F * s, (r[2][1] - r[1][2]) / s,
+            (r[0][2] - r[2][0]) / s, (r[1][0] - r[0][1]) / s };
+    } else if (r[0][0] > r[1][1] && r[0][0] > r[2][2]) {
+        s = 2 * sqrtf(1 + r[0][0] - r[1][1] - r[2][2]);
+        *q = (struct or_quat) { (r[2][1] - r[1][2]) / s, 0.25F * s,
+            (r[0][1] + r[1][0]) / s, (r[0][2] + r[2][0]) / s };
+    } else if (r[1][1] > r[2][2]) {
+        s = 2 * sqrtf(1 + r[1][1] - r[0][0] - r[2][2]);
+        *q = (struct or_quat) { (r[0][2] - r[2][0]) / s,
+            (r[0][1] + r[1][0]) / s, 0.25F * s, (r[1][2] + r[2][1]) / s };
+    } else {
+        s = 2 * sqrtf(1 + r[2][2] - r[0][0] - r[1][1]);
+        *q = (struct or_quat) { (r[1][0] - r[0][1]) / s,
+            (r[0][2] + r[2][0]) / s, (r[1][2] + r[2][1]) / s, 0.25F * s };
+    }
+
+    /* keep w >= 0, same rotation */
+    if (q->w < 0) {
+        *q = (struct or_quat) { -q->w, -q->x, -q->y, -q->z };
+    }
+
+    return (0);
+}
+
+/**
+ * Initialize the filter to the identity orientation
+ *
+ * The feedback is slow on purpose (kp around 0.5, ki around 0.1) to filter
+ * the accelerometer noise, and the heading converges very slowly from far
+ * off: call or_fusion_align() with the first sample.
+ *
+ * @param  f   filter state
+ * @param  kp  proportional gain
+ * @param  ki  integral gain, 0 to disable the gyro bias estimation
+ *
+ * @return 0 on success, non-zero on failure
+ */
+int
+or_fusion_init(struct or_fusion *f, float kp, float ki)
+{
+    f->q = (struct or_quat) { 1.0F, 0.0F, 0.0F, 0.0F };
+    f->bias[0] = f->bias[1] = f->bias[2] = 0.0F;
+
+    return or_fusion_set_gains(f, kp, ki);
+}
+
+/**
+ * Set the orientation from a single sample, the gyro bias estimate is kept
+ *
+ * @param  f      filter state
+ * @param  accel  accelerometer x, y, z
+ * @param  mag    magnetometer x, y, z, NULL for heading 0, calibrated as
+ *                in or_fusion_update()
+ *
+ * @return 0 on success, non-zero on failure
+ */
+int
+or_fusion_align(struct or_fusion *f, float const accel[3], float const mag[3])
+{
+    float m[3];
+
+    if (mag) {
+        memcpy(m, mag, sizeof(m));
+#if MYNEWT_VAL(ORIENTATION_MAGCAL)
+        or_magcal_correct(or_magcal_active, m);
+#endif
+    }
+
+    return or_quat_align(accel, mag ? m : NULL, &f->q);
+}
+
+/**
+ * Change the feedback gains, the orientation and bias estimate are kept
+ *
+ * @param  f   filter state
+ * @param  kp  proportional gain
+ * @param  ki  integral gain
+ *
+ * @return 0 on success, non-zero on failure
+ */
+int
+or_fusion_set_gains(struct or_fusion *f, float kp, float ki)
+{
+    if (kp < 0 || ki < 0) {
+        return OS_EINVAL;
+    }
+
+    f->kp2 = 2 * kp;
+    f->ki2 = 2 * ki;
+
+    return (0);
+}
+
+/**
+ * Update the orientation with one sample
+ *
+ * @param  f      filter state
+ * @param  gyro   angular rate x, y, z in rad/s
+ * @param  accel  accelerometer x, y, z, NULL or all zero to only integrate
+ *                the gyro
+ * @param  mag    magnetometer x, y, z, NULL for accel + gyro (heading is
+ *                then only from the gyro and drifts). Calibrated with
+ *                or_magcal_get() if ORIENTATION_MAGCAL is enabled
+ * @param  dt     time since the previous sample in seconds
+ *
+ * @return 0 on success, non-zero on failure
+ */
+int
+or_fusion_update(struct or_fusion *f, float const gyro[3],
+    float const accel[3], float const mag[3], float dt)
+{
+    float q0 = f->q.w;
+    float q1 = f->q.x;
+    float q2 = f->q.y;
+    float q3 = f->q.z;
+    float gx = gyro[0];
+    float gy = gyro[1];
+    float gz = gyro[2];
+
+    if (dt <= 0) {
+        return OS_EINVAL;
+    }
+
+    if (accel && (accel[0] != 0 || accel[1] != 0 || accel[2] != 0)) {
+        float n = or_inv_sqrt(accel[0] * accel[0] + accel[1] * accel[1] +
+                              accel[2] * accel[2]);
+        float const ax = accel[0] * n;
+        float const ay = accel[1] * n;
+        float const az = accel[2] * n;
+
+        /* Half of the estimated gravity direction in sensor frame */
+        float const vx = q1 * q3 - q0 * q2;
+        float const vy = q0 * q1 + q2 * q3;
+        float const vz = q0 * q0 - 0.5F + q3 * q3;
+
+        /* Half error, cross product of measured and estimated directions */
+        float ex = ay * vz - az * vy;
+        float ey = az * vx - ax * vz;
+        float ez = ax * vy - ay * vx;
+
+        float m[3];
+
+        if (mag) {
+            memcpy(m, mag, sizeof(m));
+#if MYNEWT_VAL(ORIENTATION_MAGCAL)
+            or_magcal_correct(or_magcal_active, m);
+#endif
+        }
+
+        if (mag && (m[0] != 0 || m[1] != 0 || m[2] != 0)) {
+            n = or_inv_sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+            float const mx = m[0] * n;
+            float const my = m[1] * n;
+            float const mz = m[2] * n;
+
+            float const q0q1 = q0 * q1;
+            float const q0q2 = q0 * q2;
+            float const q0q3 = q0 * q3;
+            float const q1q1 = q1 * q1;
+            float const q1q2 = q1 * q2;
+            float const q1q3 = q1 * q3;
+            float const q2q2 = q2 * q2;
+            float const q2q3 = q2 * q3;
+            float const q3q3 = q3 * q3;
+
+            /* Field in earth frame, the reference keeps only its horizontal
+             * magnitude (bx) and vertical component (bz) */
+            float const hx = 2 * (mx * (0.5F - q2q2 - q3q3) +
+                my * (q1q2 - q0q3) + mz * (q1q3 + q0q2));
+            float const hy = 2 * (mx * (q1q2 + q0q3) +
+                my * (0.5F - q1q1 - q3q3) + mz * (q2q3 - q0q1));
+            float const bx = sqrtf(hx * hx + hy * hy);
+            float const bz = 2 * (mx * (q1q3 - q0q2) + my * (q2q3 + q0q1) +
+                mz * (0.5F - q1q1 - q2q2));
+
+            /* Half of the estimated field direction in sensor frame */
+            float const wx = bx * (0.5F - q2q2 - q3q3) + bz * (q1q3 - q0q2);
+            float const wy = bx * (q1q2 - q0q3) + bz * (q0q1 + q2q3);
+            float const wz = bx * (q0q2 + q1q3) + bz * (0.5F - q1q1 - q2q2);
+
+            ex += my * wz - mz * wy;
+            ey += mz * wx - mx * wz;
+            ez += mx * wy - my * wx;
+        }
+
+        if (f->ki2 > 0) {
+            f->bias[0] += f->ki2 * ex * dt;
+            f->bias[1] += f->ki2 * ey * dt;
+            f->bias[2] += f->ki2 * ez * dt;
+        }
+
+        gx += f->kp2 * ex;
+        gy += f->kp2 * ey;
+        gz += f->kp2 * ez;
+    }
+
+    gx = (gx + f->bias[0]) * (0.5F * dt);
+    gy = (gy + f->bias[1]) * (0.5F * dt);
+    gz = (gz + f->bias[2]) * (0.5F * dt);
+
+    /* q += 0.5 * q * (0, w) * dt */
+    float const qa = q0;
+    float const qb = q1;
+    float const qc = q2;
+
+    q0 += -qb * gx - qc * gy - q3 * gz;
+    q1 += qa * gx + qc * gz - q3 * gy;
+    q2 += qa * gy - qb * gz + q3 * gx;
+    q3 += qa * gz + qb * gy - qc * gx;
+
+    float const n = or_inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+
+    f->q = (struct or_quat) { q0 * n, q1 * n, q2 * n, q3 * n };
+
+    return (0);
+}
+
+/**
+ * Current orientation as roll (X-axis), pitch (Y-axis) and heading (Z-axis)
+ * in degree, rotations applied in turn heading, pitch then roll from the
+ * earth frame. Same convention as or_from_accel_mag().
+ *
+ * @param  f    filter state
+ * @param  orv  .roll/.pitch/.heading populated
+ *
+ * @return 0 on success, non-zero on failure
+ */
+int
+or_fusion_euler(struct or_fusion const *f, struct or_orientation_vec *orv)
+{
+    float const q0 = f->q.w;
+    float const q1 = f->q.x;
+    float const q2 = f->q.y;
+    float const q3 = f->q.z;
+
+    float s = 2 * (q0 * q2 - q1 * q3);
+
+    s = s > 1.0F ? 1.0F : (s < -1.0F ? -1.0F : s);
+
+    orv->roll = or_atan2f(2 * (q0 * q1 + q2 * q3),
+        1 - 2 * (q1 * q1 + q2 * q2)) * OR_RAD_TO_DEG;
+    orv->pitch = or_atan2f(s, sqrtf(1 - s * s)) * OR_RAD_TO_DEG;
+    orv->heading = or_atan2f(2 * (q1 * q2 + q0 * q3),
+        1 - 2 * (q2 * q2 + q3 * q3)) * OR_RAD_TO_DEG;
+
+    return (0);
+}
@@ -0,0 +1,330 @@
+/*****************************************************************************/
+/*!
+    @file     orientation_fusion_q30.c
+    @author   ktownsend (Adafruit Industries)
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2017, Adafruit Industries (adafruit.com)
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/*****************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include "os/os.h"
+#include "orientation/orientation.h"
+#include "orientation_priv.h"
+
+/* Fixed-point or_fusion_update() for MCUs without FPU. Same algorithm and
+ * frames as orientation_fusion.c, with the quaternion and all unit vectors
+ * in Q30 and products carried in 64-bit. Floats are only used once in
+ * or_fusion_q30_init() to pre-multiply the gains and the gyro scale by the
+ * update period, so the period is fixed. or_fusion_q30_align() also runs
+ * once in float.
+ *
+ * Accel and mag are normalized with 15 bits of precision (3e-5 rad), which
+ * is below the noise of any MEMS sensor. The quaternion is renormalized
+ * every update with one Newton step, no division nor sqrt. */
+
+#define Q30_ONE     (1L << 30)
+#define Q30_HALF    (1L << 29)
+
+static inline int32_t
+mul30(int32_t a, int32_t b)
+{
+    return (int32_t) (((int64_t) a * b + Q30_HALF) >> 30);
+}
+
+/**
+ * Normalize a raw sensor vector to Q30
+ *
+ * @param  v    raw x, y, z
+ * @param  out  unit vector in Q30
+ *
+ * @return false if v is null (or NULL)
+ */
+static bool
+or_normalize_q30(int16_t const v[3], int32_t out[3])
+{
+    if (v == NULL) {
+        return false;
+    }
+
+    uint32_t const n = or_isqrt((uint32_t) (v[0] * v[0]) +
+        (uint32_t) (v[1] * v[1]) + (uint32_t) (v[2] * v[2]));
+
+    if (n == 0) {
+        return false;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        out[i] = ((v[i] * (1L << 15)) / (int32_t) n) * (1L << 15);
+    }
+
+    return true;
+}
+
+/**
+ * Initialize the fixed-point filter to the identity orientation, see
+ * or_fusion_init()
+ *
+ * @param  f         filter state
+ * @param  kp        proportional gain
+ * @param  ki        integral gain, 0 to disable the gyro bias estimation
+ * @param  gyro_lsb  gyro sensitivity in rad/s per LSB
+ * @param  dt        update period in seconds
+ *
+ * @return 0 on success, non-zero on failure
+ */
+int
+or_fusion_q30_init(struct or_fusion_q30 *f, float kp, float ki,
+    float gyro_lsb, float dt)
+{
+    /* Half angle per LSB and update, scaled up to 31 significant bits */
+    float k = 0.5F * dt * gyro_lsb * Q30_ONE;
+    uint8_t shift = 0;
+
+    if (dt <= 0 || gyro_lsb <= 0 || k >= 2.0F * Q30_ONE) {
+        return OS_EINVAL;
+    }
+
+    while (k < Q30_ONE && shift < 32) {
+        k *= 2;
+        shift++;
+    }
+
+    f->q = (struct or_quat_q30) { Q30_ONE, 0, 0, 0 };
+    f->bias[0] = f->bias[1] = f->bias[2] = 0;
+    f->dt = dt;
+    f->gyro_k = (int32_t) k;
+    f->gyro_shift = shift;
+
+    return or_fusion_q30_set_gains(f, kp, ki);
+}
+
+/**
+ * Set the orientation from a single sample, see or_fusion_align(). Runs
+ * once so it is computed in float.
+ *
+ * @param  f      filter state
+ * @param  accel  raw accelerometer x, y, z
+ * @param  mag    raw magnetometer x, y, z, NULL for heading 0
+ *
+ * @return 0 on success, non-zero on failure
+ */
+int
+or_fusion_q30_align(struct or_fusion_q30 *f, int16_t const accel[3],
+    int16_t const mag[3])
+{
+    float const a[3] = { accel[0], accel[1], accel[2] };
+    float m[3];
+    struct or_quat q;
+    int rc;
+
+    if (mag) {
+        m[0] = mag[0];
+        m[1] = mag[1];
+        m[2] = mag[2];
+    }
+
+    rc = or_quat_align(a, mag ? m : NULL, &q);
+    if (rc) {
+        return rc;
+    }
+
+    f->q = (struct or_quat_q30) {
+        (int32_t) (q.w * Q30_ONE), (int32_t) (q.x * Q30_ONE),
+        (int32_t) (q.y * Q30_ONE), (int32_t) (q.z * Q30_ONE)
+    };
+
+    return (0);
+}
+
+/**
+ * Change the feedback gains, see or_fusion_set_gains()
+ *
+ * @param  f   filter state
+ * @param  kp  proportional gain, kp * dt must be below 1
+ * @param  ki  integral gain
+ *
+ * @return 0 on success, non-zero on failure
+ */
+int
+or_fusion_q30_set_gains(struct or_fusion_q30 *f, float kp, float ki)
+{
+    if (kp < 0 || ki < 0 || kp * f->dt >= 1.0F) {
+        return OS_EINVAL;
+    }
+
+    f->kp_dt = (int32_t) (kp * f->dt * Q30_ONE + 0.5F);
+    f->ki_dt2 = (int32_t) (ki * f->dt * f->dt * Q30_ONE + 0.5F);
+
+    return (0);
+}
+
+/**
+ * Update the orientation with one sample taken dt (see or_fusion_q30_init)
+ * after the previous one
+ *
+ * @param  f      filter state
+ * @param  gyro   raw gyro x, y, z
+ * @param  accel  raw accelerometer x, y, z, NULL or all zero to only
+ *                integrate the gyro
+ * @param  mag    raw magnetometer x, y, z, NULL for accel + gyro
+ *
+ * @return 0 on success, non-zero on failure
+ */
+int
+or_fusion_q30_update(struct or_fusion_q30 *f, int16_t const gyro[3],
+    int16_t const accel[3], int16_t const mag[3])
+{
+    int32_t q0 = f->q.w;
+    int32_t q1 = f->q.x;
+    int32_t q2 = f->q.y;
+    int32_t q3 = f->q.z;
+    int32_t a[3], m[3];
+
+    /* Half rotation angle of this update, Q30 */
+    int32_t gx = (int32_t) (((int64_t) gyro[0] * f->gyro_k) >> f->gyro_shift);
+    int32_t gy = (int32_t) (((int64_t) gyro[1] * f->gyro_k) >> f->gyro_shift);
+    int32_t gz = (int32_t) (((int64_t) gyro[2] * f->gyro_k) >> f->gyro_shift);
+
+    if (or_normalize_q30(accel, a)) {
+        /* Half of the estimated gravity direction in sensor frame */
+        int32_t const vx = mul30(q1, q3) - mul30(q0, q2);
+        int32_t const vy = mul30(q0, q1) + mul30(q2, q3);
+        int32_t const vz = mul30(q0, q0) - Q30_HALF + mul30(q3, q3);
+
+        /* Half error, at most 1.0 with the magnetometer term */
+        int32_t ex = mul30(a[1], vz) - mul30(a[2], vy);
+        int32_t ey = mul30(a[2], vx) - mul30(a[0], vz);
+        int32_t ez = mul30(a[0], vy) - mul30(a[1], vx);
+
+        if (or_normalize_q30(mag, m)) {
+            int32_t const q0q1 = mul30(q0, q1);
+            int32_t const q0q2 = mul30(q0, q2);
+            int32_t const q0q3 = mul30(q0, q3);
+            int32_t const q1q1 = mul30(q1, q1);
+            int32_t const q1q2 = mul30(q1, q2);
+            int32_t const q1q3 = mul30(q1, q3);
+            int32_t const q2q2 = mul30(q2, q2);
+            int32_t const q2q3 = mul30(q2, q3);
+            int32_t const q3q3 = mul30(q3, q3);
+
+            /* Field in earth frame, unit vector */
+            int32_t const hx = 2 * (mul30(m[0], Q30_HALF - q2q2 - q3q3) +
+                mul30(m[1], q1q2 - q0q3) + mul30(m[2], q1q3 + q0q2));
+            int32_t const hy = 2 * (mul30(m[0], q1q2 + q0q3) +
+                mul30(m[1], Q30_HALF - q1q1 - q3q3) + mul30(m[2], q2q3 - q0q1));
+            int32_t const bz = 2 * (mul30(m[0], q1q3 - q0q2) +
+                mul30(m[1], q2q3 + q0q1) + mul30(m[2], Q30_HALF - q1q1 - q2q2));
+
+            /* Horizontal magnitude in Q15 precision */
+            int32_t const hx15 = hx >> 15;
+            int32_t const hy15 = hy >> 15;
+            int32_t const bx = (int32_t) or_isqrt((uint32_t) (hx15 * hx15) +
+                (uint32_t) (hy15 * hy15)) * (1L << 15);
+
+            /* Half of the estimated field direction in sensor frame */
+            int32_t const wx = mul30(bx, Q30_HALF - q2q2 - q3q3) +
+                mul30(bz, q1q3 - q0q2);
+            int32_t const wy = mul30(bx, q1q2 - q0q3) + mul30(bz, q0q1 + q2q3);
+            int32_t const wz = mul30(bx, q0q2 + q1q3) +
+                mul30(bz, Q30_HALF - q1q1 - q2q2);
+
+            ex += mul30(m[1], wz) - mul30(m[2], wy);
+            ey += mul30(m[2], wx) - mul30(m[0], wz);
+            ez += mul30(m[0], wy) - mul30(m[1], wx);
+        }
+
+        if (f->ki_dt2) {
+            f->bias[0] += mul30(f->ki_dt2, ex);
+            f->bias[1] += mul30(f->ki_dt2, ey);
+            f->bias[2] += mul30(f->ki_dt2, ez);
+        }
+
+        gx += mul30(f->kp_dt, ex);
+        gy += mul30(f->kp_dt, ey);
+        gz += mul30(f->kp_dt, ez);
+    }
+
+    gx += f->bias[0];
+    gy += f->bias[1];
+    gz += f->bias[2];
+
+    int32_t const qa = q0;
+    int32_t const qb = q1;
+    int32_t const qc = q2;
+
+    q0 += -mul30(qb, gx) - mul30(qc, gy) - mul30(q3, gz);
+    q1 += mul30(qa, gx) + mul30(qc, gz) - mul30(q3, gy);
+    q2 += mul30(qa, gy) - mul30(qb, gz) + mul30(q3, gx);
+    q3 += mul30(qa, gz) + mul30(qb, gy) - mul30(qc, gx);
+
+    /* 1/sqrt(n2) ~= (3 - n2) / 2 for n2 close to 1 */
+    int64_t const n2 = ((int64_t) q0 * q0 + (int64_t) q1 * q1 +
+                        (int64_t) q2 * q2 + (int64_t) q3 * q3) >> 30;
+    int32_t const k = (int32_t) ((3LL * Q30_ONE - n2) >> 1);
+
+    f->q = (struct or_quat_q30) { mul30(q0, k), mul30(q1, k), mul30(q2, k),
+                                  mul30(q3, k) };
+
+    return (0);
+}
+
+/**
+ * Current orientation as binary angles, see or_fusion_euler()
+ *
+ * @param  f    filter state
+ * @param  orv  .roll/.pitch/.heading populated
+ *
+ * @return 0 on success, non-zero on failure
+ */
+int
+or_fusion_q30_euler(struct or_fusion_q30 const *f,
+    struct or_orientation_q15 *orv)
+{
+    int32_t const q0 = f->q.w;
+    int32_t const q1 = f->q.x;
+    int32_t const q2 = f->q.y;
+    int32_t const q3 = f->q.z;
+
+    int32_t s = 2 * (mul30(q0, q2) - mul30(q1, q3));
+
+    s = s > Q30_ONE ? Q30_ONE : (s < -Q30_ONE ? -Q30_ONE : s);
+
+    int32_t const s15 = s >> 15;
+    int32_t const c15 = or_isqrt((uint32_t) Q30_ONE - (uint32_t) (s15 * s15));
+
+    orv->roll = or_atan2_q15(2 * (mul30(q0, q1) + mul30(q2, q3)),
+        2 * (Q30_HALF - mul30(q1, q1) - mul30(q2, q2)));
+    orv->pitch = or_atan2_q15(s15, c15);
+    orv->heading = or_atan2_q15(2 * (mul30(q1, q2) + mul30(q0, q3)),
+        2 * (Q30_HALF - mul30(q2, q2) - mul30(q3, q3)));
+
+    return (0);
+}
@@ -0,0 +1,630 @@
+/*****************************************************************************/
+/*!
+    @file     orientation_magcal.c
+    @author   ktownsend (Adafruit Industries)
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2017, Adafruit Industries (adafruit.com)
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/*****************************************************************************/
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include "os/os.h"
+#include "syscfg/syscfg.h"
+#include "orientation/orientation.h"
+#include "orientation_priv.h"
+
+#if MYNEWT_VAL(ORIENTATION_MAGCAL_CFG)
+#include "adafruit/ada_cfg.h"
+
+#if !MYNEWT_VAL(ADAUTIL_CFG)
+#error "ORIENTATION_MAGCAL_CFG requires ADAUTIL_CFG"
+#endif
+#endif
+
+/* Online hard/soft-iron calibration in two steps:
+ *
+ * or_magcal_add() runs per sample and keeps a bounded set of well spread
+ * readings: a sample is only stored if it is far enough from all stored
+ * ones, once full it replaces its nearest neighbour. Cost is one distance
+ * per stored sample, no allocation.
+ *
+ * or_magcal_fit() runs from a task when enough fresh samples were kept.
+ * It fits the general ellipsoid (9 parameters) by linear least squares, or
+ * a sphere (hard iron only) while there are too few samples, then derives
+ * the offset and the symmetric soft-iron matrix. The fit is only accepted
+ * if it is closer to a sphere than the current parameters on the same
+ * samples. Uses about 1 KB of stack.
+ *
+ * or_magcal_set() makes parameters active for the float orientation
+ * functions, or_magcal_save() persists them through adacfg. */
+
+#define MAGCAL_N                MYNEWT_VAL(ORIENTATION_MAGCAL_SAMPLES)
+#define MAGCAL_SPACING          0.125F  /* of the bounding box size */
+#define MAGCAL_MIN_SPHERE       8
+#define MAGCAL_MIN_ELLIPSOID    24
+#define MAGCAL_MAX_ERR          0.05F   /* relative rms error */
+#define MAGCAL_MAX_RATIO        4.0     /* between ellipsoid eigenvalues */
+
+#define MAGCAL_IDENTITY \
+    { .offset = { 0, 0, 0 }, .softiron = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } } }
+
+static struct or_magcal_params _magcal_slot[2] = {
+    MAGCAL_IDENTITY, MAGCAL_IDENTITY
+};
+
+struct or_magcal_params const * volatile or_magcal_active = &_magcal_slot[0];
+
+#if MYNEWT_VAL(ORIENTATION_MAGCAL_CFG)
+static struct or_magcal_params _magcal_cfg = MAGCAL_IDENTITY;
+
+ADACFG_BYTES("magcal/offset"  , _magcal_cfg.offset);
+ADACFG_BYTES("magcal/softiron", _magcal_cfg.softiron);
+
+static void magcal_cfg_changed(void *arg);
+
+static adacfg_listener_t _magcal_listener =
+{
+    .name = "magcal/",
+    .cb   = magcal_cfg_changed,
+};
+#endif
+
+/**
+ * Solve a * x = b in place (b becomes x) by Gaussian elimination with
+ * partial pivoting
+ *
+ * @param  a  n x n, row major, destroyed
+ * @param  b  n
+ * @param  n
+ *
+ * @return false if a is singular
+ */
+static bool
+magcal_solve(double *a, double *b, int n)
+{
+    for (int c = 0; c < n; c++) {
+        int piv = c;
+
+        for (int r = c + 1; r < n; r++) {
+            if (fabs(a[r * n + c]) > fabs(a[piv * n + c])) {
+                piv = r;
+            }
+        }
+
+        if (fabs(a[piv * n + c]) < 1e-12) {
+            return false;
+        }
+
+        if (piv != c) {
+            for (int k = 0; k < n; k++) {
+                double const t = a[c * n + k];
+                a[c * n + k] = a[piv * n + k];
+                a[piv * n + k] = t;
+            }
+
+            double const t = b[c];
+            b[c] = b[piv];
+            b[piv] = t;
+        }
+
+        for (int r = c + 1; r < n; r++) {
+            double const f = a[r * n + c] / a[c * n + c];
+
+            for (int k = c; k < n; k++) {
+                a[r * n + k] -= f * a[c * n + k];
+            }
+            b[r] -= f * b[c];
+        }
+    }
+
+    for (int c = n - 1; c >= 0; c--) {
+        double s = b[c];
+
+        for (int k = c + 1; k < n; k++) {
+            s -= a[c * n + k] * b[k];
+        }
+        b[c] = s / a[c * n + c];
+    }
+
+    return true;
+}
+
+/**
+ * Eigen decomposition of a symmetric 3x3 matrix, a = v * diag(d) * v^T
+ * (cyclic Jacobi, converges in a few sweeps)
+ *
+ * @param  a  destroyed
+ * @param  d  eigenvalues
+ * @param  v  eigenvectors in columns
+ */
+static void
+magcal_eigen(double a[3][3], double d[3], double v[3][3])
+{
+    memset(v, 0, sizeof(double[3][3]));
+    v[0][0] = v[1][1] = v[2][2] = 1;
+
+    for (int sweep = 0; sweep < 16; sweep++) {
+        if (a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2] < 1e-24) {
+            break;
+        }
+
+        for (int p = 0; p < 2; p++) {
+            for (int q = p + 1; q < 3; q++) {
+                if (a[p][q] == 0) {
+                    continue;
+                }
+
+                /* Rotation in the p, q plane zeroing a[p][q] */
+                double const theta = (a[q][q] - a[p][p]) / (2 * a[p][q]);
+                double const t = (theta >= 0 ? 1 : -1) /
+                    (fabs(theta) + sqrt(theta * theta + 1));
+                double const c = 1 / sqrt(t * t + 1);
+                double const s = t * c;
+
+                for (int k = 0; k < 3; k++) {
+                    double const kp = a[k][p];
+                    double const kq = a[k][q];
+                    a[k][p] = c * kp - s * kq;
+                    a[k][q] = s * kp + c * kq;
+                }
+                for (int k = 0; k < 3; k++) {
+                    double const pk = a[p][k];
+                    double const qk = a[q][k];
+                    a[p][k] = c * pk - s * qk;
+                    a[q][k] = s * pk + c * qk;
+                }
+                for (int k = 0; k < 3; k++) {
+                    double const kp = v[k][p];
+                    double const kq = v[k][q];
+                    v[k][p] = c * kp - s * kq;
+                    v[k][q] = s * kp + c * kq;
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < 3; i++) {
+        d[i] = a[i][i];
+    }
+}
+
+/**
+ * Sphere fit, x^2 + y^2 + z^2 = 2 * c . u + k on samples normalized to u
+ *
+ * @return 0 on success, non-zero if the samples are degenerate
+ */
+static int
+magcal_fit_sphere(struct or_magcal const *cal, double const mid[3], double scale,
+    double c[3], double w[3][3])
+{
+    double ata[4 * 4] = { 0 };
+    double atb[4] = { 0 };
+
+    for (int n = 0; n < cal->count; n++) {
+        double const x = (cal->samples[n][0] - mid[0]) / scale;
+        double const y = (cal->samples[n][1] - mid[1]) / scale;
+        double const z = (cal->samples[n][2] - mid[2]) / scale;
+        double const phi[4] = { 2 * x, 2 * y, 2 * z, 1 };
+        double const r2 = x * x + y * y + z * z;
+
+        for (int i = 0; i < 4; i++) {
+            for (int j = i; j < 4; j++) {
+                ata[i * 4 + j] += phi[i] * phi[j];
+            }
+            atb[i] += phi[i] * r2;
+        }
+    }
+
+    for (int i = 1; i < 4; i++) {
+        for (int j = 0; j < i; j++) {
+            ata[i * 4 + j] = ata[j * 4 + i];
+        }
+    }
+
+    if (!magcal_solve(ata, atb, 4) ||
+        atb[3] + atb[0] * atb[0] + atb[1] * atb[1] + atb[2] * atb[2] <= 0) {
+        return OS_ERROR;
+    }
+
+    memset(w, 0, sizeof(double[3][3]));
+
+    for (int i = 0; i < 3; i++) {
+        c[i] = atb[i];
+        w[i][i] = 1;
+    }
+
+    return (0);
+}
+
+/**
+ * Ellipsoid fit, u^T M u + 2 b . u = 1 on samples normalized to u. The
+ * center is c = -M^-1 b, the soft-iron matrix is the symmetric square root
+ * of M scaled to keep the volume.
+ *
+ * @return 0 on success, non-zero if the samples are degenerate or the
+ *         result is not a plausible ellipsoid
+ */
+static int
+magcal_fit_ellipsoid(struct or_magcal const *cal, double const mid[3],
+    double scale, double c[3], double w[3][3])
+{
+    double ata[9 * 9] = { 0 };
+    double atb[9] = { 0 };
+
+    for (int n = 0; n < cal->count; n++) {
+        double const x = (cal->samples[n][0] - mid[0]) / scale;
+        double const y = (cal->samples[n][1] - mid[1]) / scale;
+        double const z = (cal->samples[n][2] - mid[2]) / scale;
+        double const phi[9] = {
+            x * x, y * y, z * z, 2 * x * y, 2 * x * z, 2 * y * z, 2 * x, 2 * y, 2 * z
+        };
+
+        for (int i = 0; i < 9; i++) {
+            for (int j = i; j < 9; j++) {
+                ata[i * 9 + j] += phi[i] * phi[j];
+            }
+            atb[i] += phi[i];
+        }
+    }
+
+    for (int i = 1; i < 9; i++) {
+        for (int j = 0; j < i; j++) {
+            ata[i * 9 + j] = ata[j * 9 + i];
+        }
+    }
+
+    if (!magcal_solve(ata, atb, 9)) {
+        return OS_ERROR;
+    }
+
+    double const m[3][3] = {
+        { atb[0], atb[3], atb[4] },
+        { atb[3], atb[1], atb[5] },
+        { atb[4], atb[5], atb[2] }
+    };
+    double mc[3 * 3];
+
+    memcpy(mc, m, sizeof(mc));
+    c[0] = -atb[6];
+    c[1] = -atb[7];
+    c[2] = -atb[8];
+
+    if (!magcal_solve(mc, c, 3)) {
+        return OS_ERROR;
+    }
+
+    /* (u - c)^T M (u - c) = k */
+    double k = 1;
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            k += c[i] * m[i][j] * c[j];
+        }
+    }
+
+    if (k <= 0) {
+        return OS_ERROR;
+    }
+
+    double a[3][3], d[3], v[3][3];
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            a[i][j] = m[i][j] / k;
+        }
+    }
+
+    magcal_eigen(a, d, v);
+
+    double dmin = d[0], dmax = d[0];
+
+    for (int i = 1; i < 3; i++) {
+        dmin = fmin(dmin, d[i]);
+        dmax = fmax(dmax, d[i]);
+    }
+
+    if (dmin <= 0 || dmax > dmin * MAGCAL_MAX_RATIO) {
+        return OS_ERROR;
+    }
+
+    /* Semi-axes are 1/sqrt(d), scale to their geometric mean */
+    double const r = cbrt(sqrt(d[0] * d[1] * d[2]));
+    double const sd[3] = { sqrt(d[0]) / r, sqrt(d[1]) / r, sqrt(d[2]) / r };
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            w[i][j] = v[i][0] * sd[0] * v[j][0] + v[i][1] * sd[1] * v[j][1] +
+                      v[i][2] * sd[2] * v[j][2];
+        }
+    }
+
+    return (0);
+}
+
+/**
+ * Relative rms distance of the calibrated samples to their mean radius
+ */
+static float
+magcal_error(struct or_magcal const *cal, struct or_magcal_params const *p)
+{
+    double sum = 0;
+    double sum2 = 0;
+
+    for (int n = 0; n < cal->count; n++) {
+        float m[3] = { cal->samples[n][0], cal->samples[n][1], cal->samples[n][2] };
+
+        or_magcal_correct(p, m);
+
+        double const r = sqrt((double) m[0] * m[0] + (double) m[1] * m[1] +
+                              (double) m[2] * m[2]);
+        sum += r;
+        sum2 += r * r;
+    }
+
+    double const mean = sum / cal->count;
+    double const var = sum2 / cal->count - mean * mean;
+
+    return mean > 0 ? (float) (sqrt(fmax(var, 0)) / mean) : FLT_MAX;
+}
+
+/**
+ * Start a calibration from the active parameters
+ *
+ * @param  cal  calibration state
+ *
+ * @return 0 on success, non-zero on failure
+ */
+int
+or_magcal_init(struct or_magcal *cal)
+{
+    memset(cal, 0, sizeof(*cal));
+
+    for (int i = 0; i < 3; i++) {
+        cal->min[i] = FLT_MAX;
+        cal->max[i] = -FLT_MAX;
+    }
+
+    cal->fit_err = 1.0F;
+    cal->params = *or_magcal_get();
+
+    return (0);
+}
+
+/**
+ * Offer a raw magnetometer sample to the calibration, call it from the
+ * sensor read path. Bounded cost, see ORIENTATION_MAGCAL_SAMPLES.
+ *
+ * @param  cal  calibration state
+ * @param  mag  raw magnetometer sample
+ *
+ * @return true if the sample was kept, or_magcal_fit() is worth running
+ *         once cal->fresh is large enough
+ */
+bool
+or_magcal_add(struct or_magcal *cal, struct sensor_mag_data const *mag)
+{
+    float const v[3] = { mag->smd_x, mag->smd_y, mag->smd_z };
+    float size = 0;
+
+    for (int i = 0; i < 3; i++) {
+        cal->min[i] = fminf(cal->min[i], v[i]);
+        cal->max[i] = fmaxf(cal->max[i], v[i]);
+        size = fmaxf(size, cal->max[i] - cal->min[i]);
+    }
+
+    float const min_d2 = (size * MAGCAL_SPACING) * (size * MAGCAL_SPACING);
+    float near_d2 = FLT_MAX;
+    uint16_t near = 0;
+
+    for (uint16_t n = 0; n < cal->count; n++) {
+        float const dx = v[0] - cal->samples[n][0];
+        float const dy = v[1] - cal->samples[n][1];
+        float const dz = v[2] - cal->samples[n][2];
+        float const d2 = dx * dx + dy * dy + dz * dz;
+
+        if (d2 < near_d2) {
+            near_d2 = d2;
+            near = n;
+        }
+    }
+
+    if (cal->count && near_d2 <= min_d2) {
+        return false;
+    }
+
+    uint16_t const idx = cal->count < MAGCAL_N ? cal->count++ : near;
+
+    memcpy(cal->samples[idx], v, sizeof(v));
+    cal->fresh++;
+
+    return true;
+}
+
+/**
+ * Fit the kept samples, cal->params and cal->fit_err are updated if the
+ * result is better than the current parameters
+ *
+ * @param  cal  calibration state
+ *
+ * @return 0 if cal->params was updated, OS_ENOENT if there are not enough
+ *         samples yet, OS_ERROR if the fit was rejected
+ */
+int
+or_magcal_fit(struct or_magcal *cal)
+{
+    double mid[3], c[3], w[3][3];
+    double scale = 0;
+    int rc = OS_ERROR;
+
+    if (cal->count < MAGCAL_MIN_SPHERE) {
+        return OS_ENOENT;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        mid[i] = ((double) cal->min[i] + cal->max[i]) / 2;
+        scale = fmax(scale, ((double) cal->max[i] - cal->min[i]) / 2);
+    }
+
+    cal->fresh = 0;
+
+    if (scale <= 0) {
+        return OS_ERROR;
+    }
+
+    if (cal->count >= MAGCAL_MIN_ELLIPSOID) {
+        rc = magcal_fit_ellipsoid(cal, mid, scale, c, w);
+    }
+    if (rc) {
+        rc = magcal_fit_sphere(cal, mid, scale, c, w);
+    }
+    if (rc) {
+        return rc;
+    }
+
+    struct or_magcal_params p;
+
+    for (int i = 0; i < 3; i++) {
+        p.offset[i] = (float) (mid[i] + scale * c[i]);
+
+        for (int j = 0; j < 3; j++) {
+            p.softiron[i][j] = (float) w[i][j];
+        }
+    }
+
+    float const err = magcal_error(cal, &p);
+
+    if (!(err < MAGCAL_MAX_ERR) || err >= magcal_error(cal, &cal->params)) {
+        return OS_ERROR;
+    }
+
+    cal->params = p;
+    cal->fit_err = err;
+
+    return (0);
+}
+
+/**
+ * Calibrate a magnetometer sample in place
+ *
+ * @param  p    parameters, e.g or_magcal_get()
+ * @param  mag
+ */
+void
+or_magcal_apply(struct or_magcal_params const *p, struct sensor_mag_data *mag)
+{
+    float m[3] = { mag->smd_x, mag->smd_y, mag->smd_z };
+
+    or_magcal_correct(p, m);
+
+    mag->smd_x = m[0];
+    mag->smd_y = m[1];
+    mag->smd_z = m[2];
+}
+
+/**
+ * Make parameters active, see ORIENTATION_MAGCAL. Safe against concurrent
+ * readers as long as two updates are not closer than one orientation call.
+ *
+ * @param  p  parameters, copied
+ *
+ * @return 0 on success, OS_EINVAL if p has non finite values
+ */
+int
+or_magcal_set(struct or_magcal_params const *p)
+{
+    struct or_magcal_params *slot;
+
+    for (int i = 0; i < 3; i++) {
+        if (!isfinite(p->offset[i]) || !isfinite(p->softiron[i][0]) ||
+            !isfinite(p->softiron[i][1]) || !isfinite(p->softiron[i][2])) {
+            return OS_EINVAL;
+        }
+    }
+
+    slot = (or_magcal_active == &_magcal_slot[0]) ? &_magcal_slot[1] : &_magcal_slot[0];
+    *slot = *p;
+    or_magcal_active = slot;
+
+    return (0);
+}
+
+/**
+ * @return active parameters, identity until set or loaded
+ */
+struct or_magcal_params const *
+or_magcal_get(void)
+{
+    return or_magcal_active;
+}
+
+/**
+ * Persist the active parameters as adacfg variables, they are loaded back
+ * by adacfg_load() on next boot
+ *
+ * @return 0 on success, non-zero on failure
+ */
+int
+or_magcal_save(void)
+{
+#if MYNEWT_VAL(ORIENTATION_MAGCAL_CFG)
+    _magcal_cfg = *or_magcal_get();
+
+    adacfg_set_dirty("magcal/offset");
+    adacfg_set_dirty("magcal/softiron");
+
+    return adacfg_save();
+#else
+    return OS_ENOENT;
+#endif
+}
+
+#if MYNEWT_VAL(ORIENTATION_MAGCAL_CFG)
+/**
+ * adacfg listener, magcal/ variables loaded or set from CLI/newtmgr
+ */
+static void
+magcal_cfg_changed(void *arg)
+{
+    (void) arg;
+    (void) or_magcal_set(&_magcal_cfg);
+}
+#endif
+
+/**
+ * Package init, called by sysinit
+ */
+void
+orientation_pkg_init(void)
+{
+#if MYNEWT_VAL(ORIENTATION_MAGCAL_CFG)
+    adacfg_listen(&_magcal_listener);
+#endif
+}
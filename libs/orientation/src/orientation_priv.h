@@ -0,0 +1,78 @@
+/*****************************************************************************/
+/*!
+    @file     orientation_priv.h
+    @author   ktownsend (Adafruit Industries)
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2017, Adafruit Industries (adafruit.com)
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/*****************************************************************************/
+#ifndef __ORIENTATION_PRIV_H__
+#define __ORIENTATION_PRIV_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "orientation/orientation.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#define OR_Q15_HALF_PI   16384
+#define OR_Q15_PI        32768
+
+/* Shared by the fixed-point kernels, see orientation_q15.c */
+uint32_t or_isqrt(uint32_t v);
+int16_t or_atan2_q15(int32_t y, int32_t x);
+int16_t or_atan2_q15_64(int64_t y, int64_t x);
+
+/* Active magnetometer calibration, see or_magcal_set(). Readers load the
+ * pointer once per call, writers fill the other slot then swap. */
+extern struct or_magcal_params const * volatile or_magcal_active;
+
+static inline void
+or_magcal_correct(struct or_magcal_params const *p, float m[3])
+{
+    float const x = m[0] - p->offset[0];
+    float const y = m[1] - p->offset[1];
+    float const z = m[2] - p->offset[2];
+
+    m[0] = p->softiron[0][0] * x + p->softiron[0][1] * y + p->softiron[0][2] * z;
+    m[1] = p->softiron[1][0] * x + p->softiron[1][1] * y + p->softiron[1][2] * z;
+    m[2] = p->softiron[2][0] * x + p->softiron[2][1] * y + p->softiron[2][2] * z;
+}
+
+/* Shared by both fusion filters, see orientation_fusion.c */
+int or_quat_align(float const accel[3], float const mag[3], struct or_quat *q);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* __ORIENTATION_PRIV_H__ */
@@ -0,0 +1,206 @@
+/*****************************************************************************/
+/*!
+    @file     orientation_q15.c
+    @author   ktownsend (Adafruit Industries)
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2017, Adafruit Industries (adafruit.com)
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/*****************************************************************************/
+#include <stdlib.h>
+#include "orientation/orientation.h"
+#include "orientation_priv.h"
+
+/* Fixed-point versions for MCUs without FPU (e.g nRF51). Inputs are raw
+ * sensor counts, only their ratios matter. Angles are returned as binary
+ * angles: 32768 is 180 degree, so they wrap naturally in int16_t.
+ * Intermediates are Q15 ratios in 32-bit, products that need more range
+ * (heading) are carried in 64-bit and normalized back to 32-bit before the
+ * atan2. Max error is 0.1 degree, see or_atan2_q15(). */
+
+/**
+ * Integer square root
+ *
+ * @param  v
+ *
+ * @return floor(sqrt(v))
+ */
+uint32_t
+or_isqrt(uint32_t v)
+{
+    uint32_t res = 0;
+    uint32_t bit = 1UL << 30;
+
+    while (bit > v) {
+        bit >>= 2;
+    }
+
+    while (bit) {
+        if (v >= res + bit) {
+            v -= res + bit;
+            res = (res >> 1) + bit;
+        } else {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return res;
+}
+
+/**
+ * Fixed-point atan2. After octant reduction atan(t) on [0, 1] is approximated
+ * by pi/4 * t + t * (1 - t) * (0.2447 + 0.0663 * t), max error 0.0015 rad
+ * (0.086 degree) plus 0.0055 degree of output resolution.
+ *
+ * @param  y
+ * @param  x
+ *
+ * @return binary angle, 0 when x == y == 0
+ */
+int16_t
+or_atan2_q15(int32_t y, int32_t x)
+{
+    uint32_t ax = x < 0 ? -(uint32_t) x : (uint32_t) x;
+    uint32_t ay = y < 0 ? -(uint32_t) y : (uint32_t) y;
+    uint32_t mx = ax > ay ? ax : ay;
+    uint32_t mn = ax > ay ? ay : ax;
+
+    if (mx == 0) {
+        return 0;
+    }
+
+    /* Keep t = mn/mx computable in 32-bit */
+    while (mx >= (1UL << 16)) {
+        mx >>= 1;
+        mn >>= 1;
+    }
+
+    int32_t const t = (int32_t) ((mn << 15) / mx);
+    int32_t a = (t >> 2) +
+        ((((t * (32768 - t)) >> 15) * (2552 + ((691 * t) >> 15))) >> 15);
+
+    if (ay > ax) {
+        a = OR_Q15_HALF_PI - a;
+    }
+    if (x < 0) {
+        a = OR_Q15_PI - a;
+    }
+
+    return (int16_t) (y < 0 ? -a : a);
+}
+
+/**
+ * or_atan2_q15() of 64-bit arguments, both are scaled down by the same
+ * power of two which does not change the angle
+ */
+int16_t
+or_atan2_q15_64(int64_t y, int64_t x)
+{
+    while (llabs(y) >= (1LL << 30) || llabs(x) >= (1LL << 30)) {
+        y /= 2;
+        x /= 2;
+    }
+
+    return or_atan2_q15((int32_t) y, (int32_t) x);
+}
+
+/**
+ * Fixed-point or_from_accel()
+ *
+ * @param  accel raw accelerometer x, y, z
+ * @param  orv   .roll/.pitch populated, .heading set to 0
+ *
+ * @return 0 on success, non-zero on failure
+ */
+int
+or_from_accel_q15(int16_t const accel[3], struct or_orientation_q15 *orv)
+{
+    int32_t const x = accel[0];
+    int32_t const y = accel[1];
+    int32_t const z = accel[2];
+    int32_t const xz = or_isqrt((uint32_t) (x * x) + (uint32_t) (z * z));
+    int32_t const yz = or_isqrt((uint32_t) (y * y) + (uint32_t) (z * z));
+
+    orv->roll = or_atan2_q15(y, xz);
+    orv->pitch = or_atan2_q15(x, z >= 0 ? yz : -yz);
+    orv->heading = 0;
+
+    return (0);
+}
+
+/**
+ * Fixed-point or_from_accel_mag(). Heading is computed with the sine and
+ * cosine ratios multiplied out, atan2 only needs the two sides up to a
+ * common positive factor.
+ *
+ * @param  accel raw accelerometer x, y, z
+ * @param  mag   raw magnetometer x, y, z
+ * @param  orv   .roll/.pitch/.heading populated
+ *
+ * @return 0 on success, non-zero on failure
+ */
+int
+or_from_accel_mag_q15(int16_t const accel[3], int16_t const mag[3],
+    struct or_orientation_q15 *orv)
+{
+    int32_t const x = accel[0];
+    int32_t const y = accel[1];
+    int32_t const z = accel[2];
+    int64_t const mx = mag[0];
+    int64_t const my = mag[1];
+    int64_t const mz = mag[2];
+
+    uint32_t const yz2 = (uint32_t) (y * y) + (uint32_t) (z * z);
+    int32_t const yz = or_isqrt(yz2);
+
+    orv->roll = or_atan2_q15(y, z);
+
+    if (yz == 0) {
+        /* roll = 0, pitch = +/-90: heading = atan2(-my, mz * sin(pitch)) */
+        orv->pitch = x > 0 ? OR_Q15_HALF_PI : -OR_Q15_HALF_PI;
+        orv->heading = or_atan2_q15(-mag[1], x > 0 ? mag[2] : -mag[2]);
+        return (0);
+    }
+
+    orv->pitch = or_atan2_q15(-x, yz);
+
+    /* With n = sqrt(x^2 + y^2 + z^2), sin(roll) = y/yz, cos(roll) = z/yz,
+     * sin(pitch) = -x/n and cos(pitch) = yz/n. Both sides are multiplied
+     * by yz * n > 0:
+     *   num = (mz * y - my * z) * n
+     *   den = mx * yz^2 - x * (my * y + mz * z) */
+    int64_t const n = or_isqrt(yz2 + (uint32_t) (x * x));
+    int64_t const num = (mz * y - my * z) * n;
+    int64_t const den = mx * yz2 - x * (my * y + mz * z);
+
+    orv->heading = or_atan2_q15_64(num, den);
+
+    return (0);
+}
@@ -0,0 +1,265 @@
+/*****************************************************************************/
+/*!
+    @file     orientation_stream.c
+    @author   ktownsend (Adafruit Industries)
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2017, Adafruit Industries (adafruit.com)
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/*****************************************************************************/
+#include <string.h>
+#include "os/os.h"
+#include "syscfg/syscfg.h"
+#include "sensor/sensor.h"
+#include "orientation/orientation.h"
+
+#if MYNEWT_VAL(ORIENTATION_STREAM)
+
+/* Orientation service: one computation shared by all consumers.
+ *
+ * The sensor manager calls the listener from its own task for every
+ * sample type. The listener only copies the raw data and, once the
+ * accelerometer and (if present) magnetometer sample are both in, posts
+ * an event to the stream task. A slow stream task never delays the
+ * sensor manager, it just computes from the most recent raw data.
+ *
+ * The stream task publishes into two slots: it always writes the slot
+ * that is not current, then bumps the sequence number which makes it
+ * current. or_stream_get() copies the current slot and retries if the
+ * sequence moved meanwhile, i.e. if the slot it copied may have been
+ * reused. With one sample per poll period that only happens if a reader
+ * is preempted for a whole period, readers never wait on the writer. */
+
+#define STREAM_STACK_SIZE   OS_STACK_ALIGN(MYNEWT_VAL(ORIENTATION_STREAM_STACK_SIZE))
+
+struct stream_raw {
+    struct sensor_accel_data accel;
+    struct sensor_mag_data mag;
+    os_time_t ts;
+};
+
+static struct os_task _stream_task;
+static os_stack_t _stream_stack[STREAM_STACK_SIZE];
+static struct os_eventq _stream_evq;
+
+static struct sensor *_stream_sensor;
+static struct sensor_listener _stream_listener;
+static sensor_type_t _stream_mask;  /* types making a complete sample */
+static sensor_type_t _stream_got;   /* types received for the pending one */
+static struct stream_raw _stream_pending;
+
+/* Published samples, _stream_slot[_stream_seq & 1] is the current one */
+static struct or_stream_sample _stream_slot[2];
+static volatile uint32_t _stream_seq;
+
+static void
+stream_compute(struct os_event *ev)
+{
+    struct stream_raw raw;
+    struct or_stream_sample *out;
+    uint32_t seq;
+    os_sr_t sr;
+
+    (void) ev;
+
+    OS_ENTER_CRITICAL(sr);
+    raw = _stream_pending;
+    OS_EXIT_CRITICAL(sr);
+
+    /* Only this task writes _stream_seq */
+    seq = _stream_seq + 1;
+    out = &_stream_slot[seq & 1];
+
+    if (_stream_mask & SENSOR_TYPE_MAGNETIC_FIELD) {
+        or_from_accel_mag(&raw.accel, &raw.mag, &out->orv);
+    } else {
+        or_from_accel(&raw.accel, &out->orv);
+    }
+    out->ts = raw.ts;
+    out->seq = seq;
+
+    /* Slot contents must be visible before the sequence number */
+    __sync_synchronize();
+    _stream_seq = seq;
+}
+
+static struct os_event _stream_ev = {
+    .ev_cb = stream_compute,
+};
+
+static int
+stream_listener(struct sensor *sensor, void *arg, void *data,
+    sensor_type_t type)
+{
+    bool complete;
+    os_sr_t sr;
+
+    (void) sensor;
+    (void) arg;
+
+    OS_ENTER_CRITICAL(sr);
+    if (type == SENSOR_TYPE_ACCELEROMETER) {
+        _stream_pending.accel = *(struct sensor_accel_data *) data;
+        _stream_pending.ts = os_time_get();
+    } else if (type == SENSOR_TYPE_MAGNETIC_FIELD) {
+        _stream_pending.mag = *(struct sensor_mag_data *) data;
+    }
+    _stream_got |= type;
+    complete = (_stream_got & _stream_mask) == _stream_mask;
+    if (complete) {
+        _stream_got = 0;
+    }
+    OS_EXIT_CRITICAL(sr);
+
+    /* No-op if the previous sample is still queued */
+    if (complete) {
+        os_eventq_put(&_stream_evq, &_stream_ev);
+    }
+
+    return (0);
+}
+
+static void
+stream_task_handler(void *arg)
+{
+    (void) arg;
+
+    while (1) {
+        os_eventq_run(&_stream_evq);
+    }
+}
+
+/**
+ * Starts computing the orientation from a sensor
+ *
+ * The sensor is polled every rate_ms by the sensor manager. The heading is
+ * computed if the sensor has a magnetometer, the calibration set with
+ * or_magcal_set() is applied with ORIENTATION_MAGCAL.
+ *
+ * @param devname   The sensor device name, e.g. "lsm303dlhc"
+ * @param rate_ms   The poll rate in milliseconds
+ *
+ * @return 0 on success, OS_ENOENT if the sensor is not found, OS_EINVAL if
+ *         it has no accelerometer, OS_EBUSY if already started
+ */
+int
+or_stream_start(char *devname, uint32_t rate_ms)
+{
+    struct sensor *sensor;
+    int rc;
+
+    if (_stream_sensor) {
+        return (OS_EBUSY);
+    }
+
+    sensor = sensor_mgr_find_next_bydevname(devname, NULL);
+    if (!sensor) {
+        return (OS_ENOENT);
+    }
+    if (!(sensor->s_mask & SENSOR_TYPE_ACCELEROMETER)) {
+        return (OS_EINVAL);
+    }
+
+    /* The task is created once and stays idle on its queue when stopped */
+    if (!_stream_task.t_name) {
+        os_eventq_init(&_stream_evq);
+        rc = os_task_init(&_stream_task, "orientation", stream_task_handler,
+                NULL, MYNEWT_VAL(ORIENTATION_STREAM_TASK_PRIO),
+                OS_WAIT_FOREVER, _stream_stack, STREAM_STACK_SIZE);
+        if (rc != 0) {
+            return (rc);
+        }
+    }
+
+    _stream_mask = SENSOR_TYPE_ACCELEROMETER |
+        (sensor->s_mask & SENSOR_TYPE_MAGNETIC_FIELD);
+    _stream_got = 0;
+
+    memset(&_stream_listener, 0, sizeof(_stream_listener));
+    _stream_listener.sl_sensor_type = _stream_mask;
+    _stream_listener.sl_func = stream_listener;
+
+    rc = sensor_register_listener(sensor, &_stream_listener);
+    if (rc != 0) {
+        return (rc);
+    }
+
+    rc = sensor_set_poll_rate_ms(devname, rate_ms);
+    if (rc != 0) {
+        sensor_unregister_listener(sensor, &_stream_listener);
+        return (rc);
+    }
+
+    _stream_sensor = sensor;
+
+    return (0);
+}
+
+/**
+ * Stops computing the orientation, or_stream_get() keeps returning the
+ * last sample
+ *
+ * @return 0 on success, OS_ENOENT if not started
+ */
+int
+or_stream_stop(void)
+{
+    if (!_stream_sensor) {
+        return (OS_ENOENT);
+    }
+
+    sensor_unregister_listener(_stream_sensor, &_stream_listener);
+    _stream_sensor = NULL;
+
+    return (0);
+}
+
+/**
+ * Gets the latest orientation, never blocks. Can be called from any task.
+ *
+ * @param sample    Receives the latest sample
+ *
+ * @return 0 on success, OS_ENOENT if no sample was computed yet
+ */
+int
+or_stream_get(struct or_stream_sample *sample)
+{
+    uint32_t seq;
+
+    do {
+        seq = _stream_seq;
+        __sync_synchronize();
+        *sample = _stream_slot[seq & 1];
+        __sync_synchronize();
+    } while (seq != _stream_seq);
+
+    return (seq ? 0 : OS_ENOENT);
+}
+
+#endif /* MYNEWT_VAL(ORIENTATION_STREAM) */
@@ -0,0 +1,178 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <testutil/testutil.h>
+#include "test_orientation.h"
+
+#include "orientation/orientation.h"
+
+/* Jittery samples around an orientation whose roll and heading sit on the
+ * +/-180 degree wrap: every filter must reduce the jitter without pulling
+ * the output towards 0. */
+
+#define FILTER_SAMPLES      400
+#define FILTER_JITTER       5.0     /* degree, uniform */
+#define FILTER_SPIKE        90.0    /* every FILTER_SPIKE_EVERY sample */
+#define FILTER_SPIKE_EVERY  5
+#define MAX_ERR_FILTER      2.0     /* degree */
+#define MAX_ERR_TRACK       0.01    /* degree */
+#define BENCH_FILTER        100000
+
+static uint32_t rand_seed = 11;
+
+static double
+rand_uniform(double lo, double hi)
+{
+    rand_seed = rand_seed * 1664525 + 1013904223;
+    return lo + (hi - lo) * ((rand_seed >> 8) / 16777216.0);
+}
+
+static float
+wrap180(double a)
+{
+    return (float) (a - 360 * floor((a + 180) / 360));
+}
+
+static struct or_orientation_vec
+noisy(double roll, double pitch, double heading, bool spike)
+{
+    double const s = spike ? FILTER_SPIKE : 0;
+
+    return (struct or_orientation_vec) {
+        .roll = wrap180(roll + s + rand_uniform(-FILTER_JITTER, FILTER_JITTER)),
+        .pitch = wrap180(pitch + rand_uniform(-FILTER_JITTER, FILTER_JITTER)),
+        .heading = wrap180(heading - s + rand_uniform(-FILTER_JITTER, FILTER_JITTER)),
+    };
+}
+
+/* Max error of the filter outputs after the first window */
+static double
+filter_error(struct or_filter *f, bool spikes, int *outputs)
+{
+    double max_err = 0;
+
+    *outputs = 0;
+    for (int n = 0; n < FILTER_SAMPLES; n++) {
+        struct or_orientation_vec const in = noisy(180, 30, -180,
+            spikes && n % FILTER_SPIKE_EVERY == 0);
+        struct or_orientation_vec out;
+
+        if (!or_filter_update(f, &in, &out)) {
+            continue;
+        }
+        (*outputs)++;
+
+        TEST_ASSERT(fabsf(out.roll) <= 180 && fabsf(out.heading) <= 180);
+
+        if (n >= 32) {
+            max_err = fmax(max_err, angle_err(out.roll, 180));
+            max_err = fmax(max_err, angle_err(out.pitch, 30));
+            max_err = fmax(max_err, angle_err(out.heading, -180));
+        }
+    }
+
+    return max_err;
+}
+
+TEST_CASE(test_or_filter)
+{
+    static struct or_filter f, fq;
+    int outputs;
+    double err;
+
+    TEST_ASSERT(or_filter_init(&f, OR_FILTER_MEDIAN + 1, 1, 0, 1) == OS_EINVAL);
+    TEST_ASSERT(or_filter_init(&f, OR_FILTER_AVERAGE, 0, 0, 1) == OS_EINVAL);
+    TEST_ASSERT(or_filter_init(&f, OR_FILTER_MEDIAN,
+        MYNEWT_VAL(ORIENTATION_FILTER_LEN) + 1, 0, 1) == OS_EINVAL);
+    TEST_ASSERT(or_filter_init(&f, OR_FILTER_LOWPASS, 0, 0, 1) == OS_EINVAL);
+    TEST_ASSERT(or_filter_init(&f, OR_FILTER_NONE, 0, 0, 0) == OS_EINVAL);
+
+    /* Unfiltered, every sample */
+    TEST_ASSERT_FATAL(or_filter_init(&f, OR_FILTER_NONE, 0, 0, 1) == 0);
+    err = filter_error(&f, false, &outputs);
+    printf("or_filter none         max error %.2f deg, %d outputs\n", err, outputs);
+    TEST_ASSERT(outputs == FILTER_SAMPLES);
+    TEST_ASSERT(err > 0.8 * FILTER_JITTER);
+
+    TEST_ASSERT_FATAL(or_filter_init(&f, OR_FILTER_LOWPASS, 0, 0.05F, 1) == 0);
+    err = filter_error(&f, false, &outputs);
+    printf("or_filter lowpass      max error %.2f deg, %d outputs\n", err, outputs);
+    TEST_ASSERT(err <= MAX_ERR_FILTER);
+
+    /* Decimated by the window length */
+    TEST_ASSERT_FATAL(or_filter_init(&f, OR_FILTER_AVERAGE, 16, 0, 16) == 0);
+    err = filter_error(&f, false, &outputs);
+    printf("or_filter average      max error %.2f deg, %d outputs\n", err, outputs);
+    TEST_ASSERT(outputs == FILTER_SAMPLES / 16);
+    TEST_ASSERT(err <= MAX_ERR_FILTER);
+
+    /* Median stays within the jitter despite the spikes, the average does
+     * not */
+    TEST_ASSERT_FATAL(or_filter_init(&f, OR_FILTER_MEDIAN, 15, 0, 4) == 0);
+    err = filter_error(&f, true, &outputs);
+    printf("or_filter median       max error %.2f deg with spikes, %d outputs\n",
+        err, outputs);
+    TEST_ASSERT(outputs == FILTER_SAMPLES / 4);
+    TEST_ASSERT(err <= FILTER_JITTER);
+
+    TEST_ASSERT_FATAL(or_filter_init(&f, OR_FILTER_AVERAGE, 15, 0, 4) == 0);
+    TEST_ASSERT(filter_error(&f, true, &outputs) > 2 * FILTER_JITTER);
+
+    /* A steady rotation across the wrap: the moving average lags by half
+     * the window, exactly */
+    TEST_ASSERT_FATAL(or_filter_init(&f, OR_FILTER_AVERAGE, 9, 0, 1) == 0);
+    err = 0;
+    for (int n = 0; n < 200; n++) {
+        double const h = 150 + 0.5 * n;
+        struct or_orientation_vec const in = {
+            .roll = wrap180(-h), .pitch = 10, .heading = wrap180(h)
+        };
+        struct or_orientation_vec out;
+
+        TEST_ASSERT_FATAL(or_filter_update(&f, &in, &out));
+        if (n >= 8) {
+            err = fmax(err, angle_err(out.heading, h - 2));
+            err = fmax(err, angle_err(out.roll, 2 - h));
+        }
+    }
+    TEST_ASSERT(err <= MAX_ERR_TRACK);
+
+    /* Fixed point gives the same result as float */
+    TEST_ASSERT_FATAL(or_filter_init(&f, OR_FILTER_MEDIAN, 16, 0, 1) == 0);
+    TEST_ASSERT_FATAL(or_filter_init(&fq, OR_FILTER_MEDIAN, 16, 0, 1) == 0);
+    err = 0;
+    for (int n = 0; n < FILTER_SAMPLES; n++) {
+        struct or_orientation_vec const in = noisy(-180, -45, 180, false);
+        struct or_orientation_q15 const inq = {
+            .roll = (int16_t) lrint(in.roll * (32768 / 180.0)),
+            .pitch = (int16_t) lrint(in.pitch * (32768 / 180.0)),
+            .heading = (int16_t) lrint(in.heading * (32768 / 180.0))
+        };
+        struct or_orientation_vec out;
+        struct or_orientation_q15 outq;
+
+        TEST_ASSERT_FATAL(or_filter_update(&f, &in, &out));
+        TEST_ASSERT_FATAL(or_filter_update_q15(&fq, &inq, &outq));
+        err = fmax(err, angle_err(OR_Q15_TO_DEG(outq.roll), out.roll));
+        err = fmax(err, angle_err(OR_Q15_TO_DEG(outq.pitch), out.pitch));
+        err = fmax(err, angle_err(OR_Q15_TO_DEG(outq.heading), out.heading));
+    }
+    TEST_ASSERT(err <= MAX_ERR_TRACK);
+
+    /* Worst case per sample: the longest median, output every sample */
+    TEST_ASSERT_FATAL(or_filter_init(&f, OR_FILTER_MEDIAN,
+        MYNEWT_VAL(ORIENTATION_FILTER_LEN), 0, 1) == 0);
+
+    struct or_orientation_vec in = noisy(0, 0, 0, false);
+    struct or_orientation_vec out;
+    uint64_t const t0 = bench_now();
+
+    for (int n = 0; n < BENCH_FILTER; n++) {
+        in.heading = -in.heading;
+        or_filter_update(&f, &in, &out);
+    }
+
+    printf("or_filter_update       %6lu cycles/call (median of %d)\n",
+        (unsigned long) ((bench_now() - t0) / BENCH_FILTER),
+        MYNEWT_VAL(ORIENTATION_FILTER_LEN));
+}
@@ -0,0 +1,466 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <testutil/testutil.h>
+#include "test_orientation.h"
+
+#include "orientation/orientation.h"
+
+/* The filters track a simulated motion with biased and noisy sensors, then
+ * the replay harness feeds recorded sample files (see test/data) through
+ * every filter variant and prints throughput and drift.
+ *
+ * Replay files are CSV, lines starting with '#' are comments:
+ *   dt, gx, gy, gz, ax, ay, az, mx, my, mz[, roll, pitch, heading]
+ * dt in s, gyro in rad/s, accel in g, mag in gauss, optional reference
+ * angles in degree. Filters are aligned on the first sample, errors are
+ * scored after a warm up. Without reference the device is assumed static
+ * and the drift is measured from the end of the warm up. Set OR_REPLAY to a ':'
+ * separated list of files to replay others than the default one, which is
+ * looked up from the project root then next to this source file. Every
+ * listed file must load, the bundled one is also checked against
+ * replay_bound. */
+
+#define SIM_RATE          100     /* Hz */
+#define SIM_TIME          60      /* s */
+#define SIM_SETTLE        30      /* s, errors are checked once the bias converged */
+#define MAX_ERR_FUSION    2.0     /* degree */
+
+#define KP                0.5F
+#define KI                0.1F
+#define WARMUP            2.0F    /* s, replay errors are scored afterwards */
+
+#define ACCEL_SCALE       16000   /* raw counts per g or gauss */
+#define GYRO_LSB          0.001F  /* rad/s per raw count */
+
+#define REPLAY_FILE       "libs/orientation/test/data/or_replay.csv"
+#define REPLAY_MAX        12000
+#define REPLAY_LOOPS      20      /* passes for the throughput */
+
+/* Per variant bounds on the bundled file: max error roll, pitch, heading in
+ * degree, then drift in degree/min. Without magnetometer the heading drifts
+ * with the z gyro bias (34 deg/min in the file). With it the heading
+ * feedback is scaled by cos^2 of the 55 deg dip and the 16 s file is too
+ * short for the bias estimate to settle, a few degree are left. */
+static double const replay_bound[4][4] = {
+    { 2.5, 2.5, 10.0, 36.0 },   /* float 6-axis */
+    { 2.5, 2.5,  6.0, 22.0 },   /* float 9-axis */
+    { 2.5, 2.5, 10.0, 36.0 },   /* q30 6-axis */
+    { 2.5, 2.5,  6.0, 22.0 },   /* q30 9-axis */
+};
+
+static double const gyro_bias[3] = { 0.02, -0.015, 0.01 };   /* rad/s */
+
+/* Deterministic gaussian noise */
+static uint32_t noise_seed = 1;
+
+static double
+noise(double sigma)
+{
+    double u[2];
+
+    for (int i = 0; i < 2; i++) {
+        noise_seed = noise_seed * 1664525 + 1013904223;
+        u[i] = (noise_seed >> 8) / 16777216.0 + 1e-9;
+    }
+
+    return sigma * sqrt(-2 * log(u[0])) * cos(2 * M_PI * u[1]);
+}
+
+/* Smooth motion: angles and their rates in degree(/s) at time t */
+static void
+sim_motion(double t, double e[3], double de[3])
+{
+    static double const offset[3] = { 10, -20, 30 };
+    static double const amp[3] = { 30, 25, 90 };
+    static double const freq[3] = { 0.3, 0.2, 0.1 };
+
+    for (int i = 0; i < 3; i++) {
+        double const w = 2 * M_PI * freq[i];
+
+        e[i] = offset[i] + amp[i] * sin(w * t + i);
+        de[i] = amp[i] * w * cos(w * t + i);
+    }
+}
+
+/* Biased and noisy sensor sample of sim_motion() at time t */
+static void
+sim_sample(double t, float g[3], float a[3], float m[3], double e[3])
+{
+    double de[3], ad[3], md[3];
+
+    sim_motion(t, e, de);
+    make_sample(e[0], e[1], e[2], ad, md);
+
+    double const r = e[0] * M_PI / 180;
+    double const p = e[1] * M_PI / 180;
+    double const dr = de[0] * M_PI / 180;
+    double const dp = de[1] * M_PI / 180;
+    double const dh = de[2] * M_PI / 180;
+
+    /* Euler angle rates to body angular rate */
+    double const w[3] = {
+        dr - dh * sin(p),
+        dp * cos(r) + dh * cos(p) * sin(r),
+        -dp * sin(r) + dh * cos(p) * cos(r)
+    };
+
+    for (int i = 0; i < 3; i++) {
+        g[i] = w[i] + gyro_bias[i] + noise(0.005);
+        a[i] = ad[i] + noise(0.01);
+        m[i] = md[i] + noise(0.01);
+    }
+}
+
+static int16_t
+to_raw(float v, float scale)
+{
+    long const r = lroundf(v * scale);
+
+    return (int16_t) (r > INT16_MAX ? INT16_MAX : (r < INT16_MIN ? INT16_MIN : r));
+}
+
+TEST_CASE(test_or_fusion_track)
+{
+    struct or_fusion f9, f6;
+    double max_err9 = 0, max_err6 = 0;
+
+    TEST_ASSERT_FATAL(or_fusion_init(&f9, KP, KI) == 0);
+    TEST_ASSERT_FATAL(or_fusion_init(&f6, KP, KI) == 0);
+
+    noise_seed = 1;
+
+    for (int n = 0; n < SIM_RATE * SIM_TIME; n++) {
+        double const t = (double) n / SIM_RATE;
+        float g[3], a[3], m[3];
+        double e[3];
+        struct or_orientation_vec v9, v6;
+
+        sim_sample(t, g, a, m, e);
+
+        if (n == 0) {
+            TEST_ASSERT_FATAL(or_fusion_align(&f9, a, m) == 0);
+            TEST_ASSERT_FATAL(or_fusion_align(&f6, a, NULL) == 0);
+        }
+        or_fusion_update(&f9, g, a, m, 1.0F / SIM_RATE);
+        or_fusion_update(&f6, g, a, NULL, 1.0F / SIM_RATE);
+
+        if (t < SIM_SETTLE) {
+            continue;
+        }
+
+        or_fusion_euler(&f9, &v9);
+        or_fusion_euler(&f6, &v6);
+
+        max_err9 = fmax(max_err9, angle_err(v9.roll, e[0]));
+        max_err9 = fmax(max_err9, angle_err(v9.pitch, e[1]));
+        max_err9 = fmax(max_err9, angle_err(v9.heading, e[2]));
+        max_err6 = fmax(max_err6, angle_err(v6.roll, e[0]));
+        max_err6 = fmax(max_err6, angle_err(v6.pitch, e[1]));
+    }
+
+    printf("or_fusion 9-axis       max error %.3f deg\n", max_err9);
+    printf("or_fusion 6-axis       max error %.3f deg (roll, pitch)\n", max_err6);
+    printf("or_fusion gyro bias    %.4f %.4f %.4f rad/s\n",
+        f9.bias[0], f9.bias[1], f9.bias[2]);
+
+    TEST_ASSERT(max_err9 <= MAX_ERR_FUSION);
+    TEST_ASSERT(max_err6 <= MAX_ERR_FUSION);
+}
+
+TEST_CASE(test_or_fusion_q30_track)
+{
+    struct or_fusion_q30 f9, f6;
+    double max_err9 = 0, max_err6 = 0;
+
+    TEST_ASSERT_FATAL(or_fusion_q30_init(&f9, KP, KI, GYRO_LSB, 1.0F / SIM_RATE) == 0);
+    TEST_ASSERT_FATAL(or_fusion_q30_init(&f6, KP, KI, GYRO_LSB, 1.0F / SIM_RATE) == 0);
+
+    noise_seed = 1;
+
+    for (int n = 0; n < SIM_RATE * SIM_TIME; n++) {
+        double const t = (double) n / SIM_RATE;
+        float g[3], a[3], m[3];
+        int16_t gi[3], ai[3], mi[3];
+        double e[3];
+        struct or_orientation_q15 v9, v6;
+
+        sim_sample(t, g, a, m, e);
+
+        for (int i = 0; i < 3; i++) {
+            gi[i] = to_raw(g[i], 1 / GYRO_LSB);
+            ai[i] = to_raw(a[i], ACCEL_SCALE);
+            mi[i] = to_raw(m[i], ACCEL_SCALE);
+        }
+
+        if (n == 0) {
+            TEST_ASSERT_FATAL(or_fusion_q30_align(&f9, ai, mi) == 0);
+            TEST_ASSERT_FATAL(or_fusion_q30_align(&f6, ai, NULL) == 0);
+        }
+
+        or_fusion_q30_update(&f9, gi, ai, mi);
+        or_fusion_q30_update(&f6, gi, ai, NULL);
+
+        if (t < SIM_SETTLE) {
+            continue;
+        }
+
+        or_fusion_q30_euler(&f9, &v9);
+        or_fusion_q30_euler(&f6, &v6);
+
+        max_err9 = fmax(max_err9, angle_err(OR_Q15_TO_DEG(v9.roll), e[0]));
+        max_err9 = fmax(max_err9, angle_err(OR_Q15_TO_DEG(v9.pitch), e[1]));
+        max_err9 = fmax(max_err9, angle_err(OR_Q15_TO_DEG(v9.heading), e[2]));
+        max_err6 = fmax(max_err6, angle_err(OR_Q15_TO_DEG(v6.roll), e[0]));
+        max_err6 = fmax(max_err6, angle_err(OR_Q15_TO_DEG(v6.pitch), e[1]));
+    }
+
+    printf("or_fusion_q30 9-axis   max error %.3f deg\n", max_err9);
+    printf("or_fusion_q30 6-axis   max error %.3f deg (roll, pitch)\n", max_err6);
+
+    TEST_ASSERT(max_err9 <= MAX_ERR_FUSION);
+    TEST_ASSERT(max_err6 <= MAX_ERR_FUSION);
+}
+
+/*------------------------------------------------------------------*/
+/* Replay harness
+ *------------------------------------------------------------------*/
+struct replay_sample {
+    float dt;
+    float g[3];
+    float a[3];
+    float m[3];
+    float ref[3];
+    int16_t gi[3];
+    int16_t ai[3];
+    int16_t mi[3];
+};
+
+struct replay_result {
+    double max_err[3];
+    double end_err[3];
+    double duration;
+    double updates_per_sec;
+    uint64_t cycles;
+};
+
+static struct replay_sample replay[REPLAY_MAX];
+static int replay_cnt;
+static bool replay_has_ref;
+
+static int
+replay_load(char const *path)
+{
+    FILE *fp = fopen(path, "r");
+    char line[256];
+
+    if (fp == NULL) {
+        return -1;
+    }
+
+    replay_cnt = 0;
+    replay_has_ref = true;
+
+    while (replay_cnt < REPLAY_MAX && fgets(line, sizeof(line), fp)) {
+        struct replay_sample *s = &replay[replay_cnt];
+
+        if (line[0] == '#') {
+            continue;
+        }
+
+        int const n = sscanf(line, "%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f",
+            &s->dt, &s->g[0], &s->g[1], &s->g[2], &s->a[0], &s->a[1],
+            &s->a[2], &s->m[0], &s->m[1], &s->m[2], &s->ref[0], &s->ref[1],
+            &s->ref[2]);
+
+        if (n < 10 || s->dt <= 0) {
+            continue;
+        }
+
+        if (n < 13) {
+            replay_has_ref = false;
+        }
+
+        for (int i = 0; i < 3; i++) {
+            s->gi[i] = to_raw(s->g[i], 1 / GYRO_LSB);
+            s->ai[i] = to_raw(s->a[i], ACCEL_SCALE);
+            s->mi[i] = to_raw(s->m[i], ACCEL_SCALE);
+        }
+
+        replay_cnt++;
+    }
+
+    fclose(fp);
+
+    return replay_cnt;
+}
+
+/* Error of estimate e of sample idx. Heading without magnetometer and any
+ * angle without reference are relative to the end of the warm up (e0). */
+static void
+replay_score(struct replay_result *res, int idx, double const e[3],
+    double const e0[3], int idx0, bool use_mag)
+{
+    for (int i = 0; i < 3; i++) {
+        double err;
+
+        if (replay_has_ref && (use_mag || i != 2)) {
+            err = angle_err(e[i], replay[idx].ref[i]);
+        } else if (replay_has_ref) {
+            err = angle_err(e[i] - e0[i], replay[idx].ref[i] - replay[idx0].ref[i]);
+        } else {
+            err = angle_err(e[i], e0[i]);
+        }
+
+        res->max_err[i] = fmax(res->max_err[i], err);
+        res->end_err[i] = err;
+    }
+}
+
+/* Feed the whole file, each pass from a fresh filter, pass 0 is scored */
+static void
+replay_run(bool fixed, bool use_mag, struct replay_result *res)
+{
+    struct or_fusion f;
+    struct or_fusion_q30 fq;
+    double e0[3] = { 0 };
+    int idx0 = 0;
+    clock_t c0 = 0;
+    uint64_t t0 = 0;
+
+    memset(res, 0, sizeof(*res));
+
+    for (int pass = 0; pass <= REPLAY_LOOPS; pass++) {
+        double t = 0;
+
+        or_fusion_init(&f, KP, KI);
+        or_fusion_q30_init(&fq, KP, KI, GYRO_LSB, replay[0].dt);
+        or_fusion_align(&f, replay[0].a, use_mag ? replay[0].m : NULL);
+        or_fusion_q30_align(&fq, replay[0].ai, use_mag ? replay[0].mi : NULL);
+
+        /* Pass 0 warms the caches, timing starts at pass 1 */
+        if (pass == 1) {
+            c0 = clock();
+            t0 = bench_now();
+        }
+
+        for (int n = 0; n < replay_cnt; n++) {
+            struct replay_sample const *s = &replay[n];
+            bool const warm = t < WARMUP;
+
+            if (fixed) {
+                or_fusion_q30_update(&fq, s->gi, s->ai, use_mag ? s->mi : NULL);
+            } else {
+                or_fusion_update(&f, s->g, s->a, use_mag ? s->m : NULL, s->dt);
+            }
+
+            t += s->dt;
+
+            if (pass || warm) {
+                continue;
+            }
+
+            double e[3];
+
+            if (fixed) {
+                struct or_orientation_q15 v;
+                or_fusion_q30_euler(&fq, &v);
+                e[0] = OR_Q15_TO_DEG(v.roll);
+                e[1] = OR_Q15_TO_DEG(v.pitch);
+                e[2] = OR_Q15_TO_DEG(v.heading);
+            } else {
+                struct or_orientation_vec v;
+                or_fusion_euler(&f, &v);
+                e[0] = v.roll;
+                e[1] = v.pitch;
+                e[2] = v.heading;
+            }
+
+            if (idx0 == 0) {
+                idx0 = n;
+                memcpy(e0, e, sizeof(e0));
+            }
+
+            replay_score(res, n, e, e0, idx0, use_mag);
+        }
+
+        res->duration = t;
+    }
+
+    uint64_t const cycles = bench_now() - t0;
+    double const secs = (double) (clock() - c0) / CLOCKS_PER_SEC;
+    double const updates = (double) replay_cnt * REPLAY_LOOPS;
+
+    res->updates_per_sec = secs > 0 ? updates / secs : 0;
+    res->cycles = (uint64_t) (cycles / updates);
+}
+
+/* Default file, relative to the project root or else to this source */
+static char const *
+replay_default(char *buf, size_t len)
+{
+    char const *dir = strrchr(__FILE__, '/');
+    FILE *fp = fopen(REPLAY_FILE, "r");
+
+    if (fp || dir == NULL) {
+        if (fp) {
+            fclose(fp);
+        }
+        return REPLAY_FILE;
+    }
+
+    snprintf(buf, len, "%.*s/../data/%s", (int) (dir - __FILE__), __FILE__,
+        strrchr(REPLAY_FILE, '/') + 1);
+
+    return buf;
+}
+
+TEST_CASE(test_or_fusion_replay)
+{
+    static char const * const name[4] = {
+        "float 6-axis", "float 9-axis", "q30 6-axis", "q30 9-axis"
+    };
+    char paths[512], def[256];
+    char const *env = getenv("OR_REPLAY");
+
+    strncpy(paths, env ? env : replay_default(def, sizeof(def)),
+        sizeof(paths) - 1);
+    paths[sizeof(paths) - 1] = 0;
+
+    for (char *path = strtok(paths, ":"); path; path = strtok(NULL, ":")) {
+        if (replay_load(path) <= 0) {
+            printf("replay %s: no samples, run from the project root or "
+                   "set OR_REPLAY\n", path);
+            TEST_ASSERT(0);
+            continue;
+        }
+
+        printf("replay %s: %d samples, %s\n", path, replay_cnt,
+            replay_has_ref ? "reference angles" : "static");
+        printf("  filter        updates/s  cycles  max err r/p/h deg     "
+               "end err r/p/h deg     drift deg/min\n");
+
+        for (int k = 0; k < 4; k++) {
+            struct replay_result res;
+
+            replay_run(k >= 2, k & 1, &res);
+
+            double const drift = res.end_err[2] * 60 / res.duration;
+
+            printf("  %-12s %10.0f %7lu  %5.2f %5.2f %6.2f     "
+                   "%5.2f %5.2f %6.2f     %6.2f\n", name[k],
+                   res.updates_per_sec, (unsigned long) res.cycles,
+                   res.max_err[0], res.max_err[1], res.max_err[2],
+                   res.end_err[0], res.end_err[1], res.end_err[2], drift);
+
+            for (int i = 0; i < 3; i++) {
+                TEST_ASSERT(isfinite(res.max_err[i]));
+                TEST_ASSERT(env || res.max_err[i] <= replay_bound[k][i]);
+            }
+            TEST_ASSERT(env || drift <= replay_bound[k][3]);
+        }
+    }
+}
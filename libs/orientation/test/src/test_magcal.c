@@ -0,0 +1,184 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <testutil/testutil.h>
+#include "test_orientation.h"
+
+#include "orientation/orientation.h"
+
+/* A device rotated through random orientations measures the earth field
+ * distorted by a hard-iron offset larger than the field itself and a
+ * soft-iron matrix. The calibration must bring the heading error from tens
+ * of degree down to MAX_ERR_MAGCAL. */
+
+#define MAGCAL_SAMPLES    2000
+#define MAGCAL_FIT_EVERY  16      /* fresh samples between fits */
+#define MAX_ERR_MAGCAL    2.0     /* degree */
+#define MAX_ADD_US        50
+#define BENCH_PROBES      32      /* kept samples per timed round */
+#define BENCH_ROUNDS      300
+
+static float const field = 0.5F;   /* gauss */
+static float const hard_iron[3] = { 0.6F, -0.35F, 0.25F };
+static float const soft_iron[3][3] = {
+    { 1.15F, 0.08F, -0.03F },
+    { 0.08F, 0.90F, 0.05F },
+    { -0.03F, 0.05F, 1.00F }
+};
+
+static uint32_t rand_seed = 7;
+
+static double
+rand_uniform(double lo, double hi)
+{
+    rand_seed = rand_seed * 1664525 + 1013904223;
+    return lo + (hi - lo) * ((rand_seed >> 8) / 16777216.0);
+}
+
+/* Raw reading of the device at roll/pitch/heading, accel returned too */
+static void
+distorted_sample(double roll, double pitch, double heading,
+    struct sensor_accel_data *accel, struct sensor_mag_data *mag)
+{
+    double a[3], m[3];
+    float raw[3];
+
+    make_sample(roll, pitch, heading, a, m);
+
+    for (int i = 0; i < 3; i++) {
+        raw[i] = hard_iron[i] + rand_uniform(-0.002, 0.002);
+
+        for (int j = 0; j < 3; j++) {
+            raw[i] += soft_iron[i][j] * field * m[j];
+        }
+    }
+
+    *accel = (struct sensor_accel_data) { .sad_x = a[0], .sad_y = a[1], .sad_z = a[2] };
+    *mag = (struct sensor_mag_data) { .smd_x = raw[0], .smd_y = raw[1], .smd_z = raw[2] };
+}
+
+/* Max heading error of or_from_accel_mag() with the active calibration */
+static double
+heading_error(void)
+{
+    double max_err = 0;
+
+    for (int roll = -60; roll <= 60; roll += 20) {
+        for (int pitch = -60; pitch <= 60; pitch += 20) {
+            for (int heading = -180; heading < 180; heading += 15) {
+                struct sensor_accel_data accel;
+                struct sensor_mag_data mag;
+                struct or_orientation_vec orv;
+
+                distorted_sample(roll, pitch, heading, &accel, &mag);
+                or_from_accel_mag(&accel, &mag, &orv);
+
+                max_err = fmax(max_err, angle_err(orv.heading, heading));
+            }
+        }
+    }
+
+    return max_err;
+}
+
+TEST_CASE(test_or_magcal)
+{
+    static struct or_magcal cal;
+    struct or_magcal_params const identity = {
+        .softiron = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } }
+    };
+    int fits = 0;
+
+    TEST_ASSERT_FATAL(or_magcal_set(&identity) == 0);
+    TEST_ASSERT_FATAL(or_magcal_init(&cal) == 0);
+
+    double const err_raw = heading_error();
+
+    for (int n = 0; n < MAGCAL_SAMPLES; n++) {
+        struct sensor_accel_data accel;
+        struct sensor_mag_data mag;
+
+        distorted_sample(rand_uniform(-180, 180), rand_uniform(-90, 90),
+            rand_uniform(-180, 180), &accel, &mag);
+
+        if (or_magcal_add(&cal, &mag) && cal.fresh >= MAGCAL_FIT_EVERY &&
+            or_magcal_fit(&cal) == 0) {
+            fits++;
+        }
+    }
+
+    TEST_ASSERT_FATAL(fits > 0);
+    TEST_ASSERT_FATAL(or_magcal_set(&cal.params) == 0);
+
+    double const err_cal = heading_error();
+
+    printf("or_magcal              %d samples kept, %d fits, rms error %.4f\n",
+        cal.count, fits, cal.fit_err);
+    printf("or_magcal              heading error %.2f deg raw, %.3f deg calibrated\n",
+        err_raw, err_cal);
+
+    TEST_ASSERT(err_cal <= MAX_ERR_MAGCAL);
+    TEST_ASSERT(err_raw > 10 * MAX_ERR_MAGCAL);
+
+    /* Per sample cost with a full buffer. Kept samples also write the
+     * buffer, so the probes are spread on a unit sphere, far from a tight
+     * cluster filling the buffer and from each other (about 0.6 apart
+     * against a minimum spacing of 0.3). The buffer is restored untimed
+     * before each round so every probe is kept. Each call computes one
+     * distance per buffered sample.
+     *
+     * The MAX_ADD_US budget is for the target. Host cycles say nothing
+     * about it, so on the native BSP they are only printed. */
+    static struct or_magcal full;
+    struct sensor_mag_data probe[BENCH_PROBES];
+    uint64_t ticks = 0;
+    int kept = 0;
+
+    memset(&full, 0, sizeof(full));
+    full.count = MYNEWT_VAL(ORIENTATION_MAGCAL_SAMPLES);
+    for (int n = 0; n < full.count; n++) {
+        full.samples[n][0] = 1e-3F * (n % 4);
+        full.samples[n][1] = 1e-3F * (n / 4 % 4);
+        full.samples[n][2] = 1e-3F * (n / 16);
+    }
+    for (int i = 0; i < 3; i++) {
+        full.min[i] = -1.2F;
+        full.max[i] = 1.2F;
+    }
+
+    for (int n = 0; n < BENCH_PROBES; n++) {
+        double const z = 1 - (2 * n + 1.0) / BENCH_PROBES;
+        double const r = sqrt(1 - z * z);
+        double const a = n * M_PI * (3 - sqrt(5));
+
+        probe[n] = (struct sensor_mag_data) {
+            .smd_x = r * cos(a), .smd_y = r * sin(a), .smd_z = z
+        };
+    }
+
+    for (int k = 0; k < BENCH_ROUNDS; k++) {
+        cal = full;
+
+        uint64_t const t0 = bench_now();
+        for (int n = 0; n < BENCH_PROBES; n++) {
+            kept += or_magcal_add(&cal, &probe[n]);
+        }
+        ticks += bench_now() - t0;
+    }
+
+    TEST_ASSERT(kept == BENCH_ROUNDS * BENCH_PROBES);
+
+#if BENCH_HOST
+    printf("or_magcal_add          %6lu host cycles/call, %d distances\n",
+        (unsigned long) (ticks / (BENCH_ROUNDS * BENCH_PROBES)), full.count);
+#else
+    uint32_t const us = os_cputime_ticks_to_usecs(ticks);
+
+    printf("or_magcal_add          %6lu us/call, %d distances\n",
+        (unsigned long) (us / (BENCH_ROUNDS * BENCH_PROBES)), full.count);
+
+    TEST_ASSERT(us <= MAX_ADD_US * BENCH_ROUNDS * BENCH_PROBES);
+#endif
+
+    TEST_ASSERT(or_magcal_set(&identity) == 0);
+}
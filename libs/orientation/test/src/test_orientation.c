@@ -0,0 +1,338 @@
+#include <math.h>
+#include <testutil/testutil.h>
+#include "test_orientation.h"
+
+#include "orientation/orientation.h"
+
+/* Accuracy is checked against the original double-precision code over a
+ * grid of orientations, then cycles per call of each version are printed.
+ * Heading is only checked away from pitch +/-90 where it is undefined. */
+
+#define DEG_TO_RAD(_d)    ((_d) * M_PI / 180)
+
+#define MAX_ERR_FLOAT     0.01    /* degree */
+#define MAX_ERR_Q15       0.2     /* degree */
+#define Q15_SCALE         16000   /* raw counts of a unit vector */
+
+#define BENCH_LOOP        10000
+#define BATCH_LEN         256
+
+/* Same math as the original or_from_accel() */
+static void
+ref_from_accel(double x, double y, double z, double *roll, double *pitch)
+{
+    double sign_z = z >= 0 ? 1.0 : -1.0;
+
+    *roll = atan2(y, sqrt(x * x + z * z)) * 180 / M_PI;
+    *pitch = atan2(x, sign_z * sqrt(y * y + z * z)) * 180 / M_PI;
+}
+
+/* Same math as the original or_from_accel_mag() */
+static void
+ref_from_accel_mag(double const a[3], double const m[3], double *roll,
+    double *pitch, double *heading)
+{
+    double r = atan2(a[1], a[2]);
+    double p;
+
+    if (a[1] * sin(r) + a[2] * cos(r) == 0) {
+        p = a[0] > 0 ? (M_PI / 2) : (-M_PI / 2);
+    } else {
+        p = atan(-a[0] / (a[1] * sin(r) + a[2] * cos(r)));
+    }
+
+    double h = atan2(m[2] * sin(r) - m[1] * cos(r),
+        m[0] * cos(p) + m[1] * sin(p) * sin(r) + m[2] * sin(p) * cos(r));
+
+    *roll = r * 180 / M_PI;
+    *pitch = p * 180 / M_PI;
+    *heading = h * 180 / M_PI;
+}
+
+/* Difference of two angles in degree, taking the wrap at +/-180 into account */
+double
+angle_err(double a, double b)
+{
+    double d = fmod(a - b, 360);
+
+    if (d > 180) {
+        d -= 360;
+    } else if (d < -180) {
+        d += 360;
+    }
+
+    return fabs(d);
+}
+
+/* Sensor readings for a device at roll/pitch/heading (degree), with the
+ * earth field pointing north and 60 degree down */
+void
+make_sample(double roll, double pitch, double heading, double a[3], double m[3])
+{
+    double const r = DEG_TO_RAD(roll);
+    double const p = DEG_TO_RAD(pitch);
+    double const h = DEG_TO_RAD(heading);
+    double const dip = DEG_TO_RAD(60);
+
+    /* Gravity in body frame */
+    a[0] = -sin(p);
+    a[1] = cos(p) * sin(r);
+    a[2] = cos(p) * cos(r);
+
+    /* Earth field rotated by heading, pitch then roll into body frame */
+    double const n[3] = { cos(dip) * cos(h), -cos(dip) * sin(h), sin(dip) };
+    double const t0 = n[0] * cos(p) - n[2] * sin(p);
+    double const t2 = n[0] * sin(p) + n[2] * cos(p);
+
+    m[0] = t0;
+    m[1] = n[1] * cos(r) + t2 * sin(r);
+    m[2] = -n[1] * sin(r) + t2 * cos(r);
+}
+
+TEST_SUITE(test_orientation_suite)
+{
+    test_or_accel_error();
+    test_or_accel_mag_error();
+    test_or_q15_error();
+    test_or_batch();
+    test_or_benchmark();
+    test_or_fusion_track();
+    test_or_fusion_q30_track();
+    test_or_fusion_replay();
+    test_or_magcal();
+    test_or_filter();
+}
+
+#ifdef MYNEWT_SELFTEST
+
+int main (int argc, char **argv)
+{
+  tu_config.tc_print_results = 1;
+  tu_init();
+  test_orientation_suite();
+  return tu_any_failed;
+}
+
+#endif
+
+TEST_CASE(test_or_accel_error)
+{
+    double max_err = 0;
+
+    for (int roll = -180; roll < 180; roll += 5) {
+        for (int pitch = -90; pitch <= 90; pitch += 5) {
+            double a[3], m[3], ref_roll, ref_pitch;
+            make_sample(roll, pitch, 0, a, m);
+
+            struct sensor_accel_data accel = { .sad_x = a[0], .sad_y = a[1], .sad_z = a[2] };
+            struct or_orientation_vec orv;
+
+            ref_from_accel(accel.sad_x, accel.sad_y, accel.sad_z, &ref_roll, &ref_pitch);
+            TEST_ASSERT_FATAL(or_from_accel(&accel, &orv) == 0);
+
+            max_err = fmax(max_err, angle_err(orv.roll, ref_roll));
+            max_err = fmax(max_err, angle_err(orv.pitch, ref_pitch));
+        }
+    }
+
+    printf("or_from_accel          max error %.5f deg\n", max_err);
+    TEST_ASSERT(max_err <= MAX_ERR_FLOAT);
+}
+
+TEST_CASE(test_or_accel_mag_error)
+{
+    double max_err = 0;
+
+    for (int roll = -180; roll < 180; roll += 10) {
+        for (int pitch = -80; pitch <= 80; pitch += 10) {
+            for (int heading = -180; heading < 180; heading += 15) {
+                double a[3], m[3], ref[3];
+                make_sample(roll, pitch, heading, a, m);
+
+                struct sensor_accel_data accel = { .sad_x = a[0], .sad_y = a[1], .sad_z = a[2] };
+                struct sensor_mag_data mag = { .smd_x = m[0], .smd_y = m[1], .smd_z = m[2] };
+                struct or_orientation_vec orv;
+
+                /* Reference from the same float inputs */
+                double const af[3] = { accel.sad_x, accel.sad_y, accel.sad_z };
+                double const mf[3] = { mag.smd_x, mag.smd_y, mag.smd_z };
+                ref_from_accel_mag(af, mf, &ref[0], &ref[1], &ref[2]);
+
+                TEST_ASSERT_FATAL(or_from_accel_mag(&accel, &mag, &orv) == 0);
+
+                max_err = fmax(max_err, angle_err(orv.roll, ref[0]));
+                max_err = fmax(max_err, angle_err(orv.pitch, ref[1]));
+                max_err = fmax(max_err, angle_err(orv.heading, ref[2]));
+            }
+        }
+    }
+
+    printf("or_from_accel_mag      max error %.5f deg\n", max_err);
+    TEST_ASSERT(max_err <= MAX_ERR_FLOAT);
+}
+
+TEST_CASE(test_or_q15_error)
+{
+    double max_err_accel = 0;
+    double max_err_mag = 0;
+
+    for (int roll = -180; roll < 180; roll += 10) {
+        for (int pitch = -80; pitch <= 80; pitch += 10) {
+            for (int heading = -180; heading < 180; heading += 15) {
+                double a[3], m[3], ref[3], ref_roll, ref_pitch;
+                int16_t ai[3], mi[3];
+                make_sample(roll, pitch, heading, a, m);
+
+                for (int i = 0; i < 3; i++) {
+                    ai[i] = (int16_t) lround(a[i] * Q15_SCALE);
+                    mi[i] = (int16_t) lround(m[i] * Q15_SCALE);
+                }
+
+                double const ad[3] = { ai[0], ai[1], ai[2] };
+                double const md[3] = { mi[0], mi[1], mi[2] };
+                struct or_orientation_q15 orq;
+
+                ref_from_accel(ad[0], ad[1], ad[2], &ref_roll, &ref_pitch);
+                TEST_ASSERT_FATAL(or_from_accel_q15(ai, &orq) == 0);
+
+                max_err_accel = fmax(max_err_accel, angle_err(OR_Q15_TO_DEG(orq.roll), ref_roll));
+                max_err_accel = fmax(max_err_accel, angle_err(OR_Q15_TO_DEG(orq.pitch), ref_pitch));
+
+                ref_from_accel_mag(ad, md, &ref[0], &ref[1], &ref[2]);
+                TEST_ASSERT_FATAL(or_from_accel_mag_q15(ai, mi, &orq) == 0);
+
+                max_err_mag = fmax(max_err_mag, angle_err(OR_Q15_TO_DEG(orq.roll), ref[0]));
+                max_err_mag = fmax(max_err_mag, angle_err(OR_Q15_TO_DEG(orq.pitch), ref[1]));
+                max_err_mag = fmax(max_err_mag, angle_err(OR_Q15_TO_DEG(orq.heading), ref[2]));
+            }
+        }
+    }
+
+    printf("or_from_accel_q15      max error %.5f deg\n", max_err_accel);
+    printf("or_from_accel_mag_q15  max error %.5f deg\n", max_err_mag);
+
+    TEST_ASSERT(max_err_accel <= MAX_ERR_Q15);
+    TEST_ASSERT(max_err_mag <= MAX_ERR_Q15);
+}
+
+/* Batch functions must give bit-identical results to the single sample ones */
+TEST_CASE(test_or_batch)
+{
+    static float ax[BATCH_LEN], ay[BATCH_LEN], az[BATCH_LEN];
+    static float mx[BATCH_LEN], my[BATCH_LEN], mz[BATCH_LEN];
+    static float roll[BATCH_LEN], pitch[BATCH_LEN], heading[BATCH_LEN];
+
+    struct or_vec3_soa const accel = { ax, ay, az };
+    struct or_vec3_soa const mag = { mx, my, mz };
+    struct or_orientation_soa orv = { roll, pitch, heading };
+
+    for (int i = 0; i < BATCH_LEN; i++) {
+        double a[3], m[3];
+        make_sample(i * 5 - 180, (i % 37) * 5 - 90, i * 7, a, m);
+
+        ax[i] = a[0]; ay[i] = a[1]; az[i] = a[2];
+        mx[i] = m[0]; my[i] = m[1]; mz[i] = m[2];
+    }
+
+    /* lying on its side, y = z = 0 */
+    ax[0] = 1; ay[0] = 0; az[0] = 0;
+
+    TEST_ASSERT_FATAL(or_from_accel_mag_batch(&accel, &mag, &orv, BATCH_LEN) == 0);
+
+    for (int i = 0; i < BATCH_LEN; i++) {
+        struct sensor_accel_data sad = { .sad_x = ax[i], .sad_y = ay[i], .sad_z = az[i] };
+        struct sensor_mag_data smd = { .smd_x = mx[i], .smd_y = my[i], .smd_z = mz[i] };
+        struct or_orientation_vec v;
+
+        or_from_accel_mag(&sad, &smd, &v);
+        TEST_ASSERT(v.roll == roll[i] && v.pitch == pitch[i] && v.heading == heading[i]);
+    }
+
+    TEST_ASSERT_FATAL(or_from_accel_batch(&accel, &orv, BATCH_LEN) == 0);
+
+    for (int i = 0; i < BATCH_LEN; i++) {
+        struct sensor_accel_data sad = { .sad_x = ax[i], .sad_y = ay[i], .sad_z = az[i] };
+        struct or_orientation_vec v;
+
+        or_from_accel(&sad, &v);
+        TEST_ASSERT(v.roll == roll[i] && v.pitch == pitch[i]);
+    }
+}
+
+TEST_CASE(test_or_benchmark)
+{
+    static float ax[36], ay[36], az[36], mx[36], my[36], mz[36];
+    static float roll[36], pitch[36], heading[36];
+    static struct sensor_accel_data accel[36];
+    static struct sensor_mag_data mag[36];
+    static int16_t ai[36][3], mi[36][3];
+    volatile double sink = 0;
+
+    for (int i = 0; i < 36; i++) {
+        double a[3], m[3];
+        make_sample(i * 10 - 180, (i % 17) * 10 - 80, i * 10, a, m);
+
+        accel[i] = (struct sensor_accel_data) { .sad_x = a[0], .sad_y = a[1], .sad_z = a[2] };
+        mag[i] = (struct sensor_mag_data) { .smd_x = m[0], .smd_y = m[1], .smd_z = m[2] };
+
+        ax[i] = a[0]; ay[i] = a[1]; az[i] = a[2];
+        mx[i] = m[0]; my[i] = m[1]; mz[i] = m[2];
+
+        for (int j = 0; j < 3; j++) {
+            ai[i][j] = (int16_t) lround(a[j] * Q15_SCALE);
+            mi[i][j] = (int16_t) lround(m[j] * Q15_SCALE);
+        }
+    }
+
+    struct or_vec3_soa const accel_soa = { ax, ay, az };
+    struct or_vec3_soa const mag_soa = { mx, my, mz };
+    struct or_orientation_soa orv_soa = { roll, pitch, heading };
+
+    uint64_t t[6];
+
+    t[0] = bench_now();
+    for (int n = 0; n < BENCH_LOOP; n++) {
+        double r, p, h;
+        double const a[3] = { accel[n % 36].sad_x, accel[n % 36].sad_y, accel[n % 36].sad_z };
+        double const m[3] = { mag[n % 36].smd_x, mag[n % 36].smd_y, mag[n % 36].smd_z };
+        ref_from_accel_mag(a, m, &r, &p, &h);
+        sink += h;
+    }
+
+    t[1] = bench_now();
+    for (int n = 0; n < BENCH_LOOP; n++) {
+        struct or_orientation_vec orv;
+        or_from_accel_mag(&accel[n % 36], &mag[n % 36], &orv);
+        sink += orv.heading;
+    }
+
+    t[2] = bench_now();
+    for (int n = 0; n < BENCH_LOOP; n++) {
+        struct or_orientation_q15 orq;
+        or_from_accel_mag_q15(ai[n % 36], mi[n % 36], &orq);
+        sink += orq.heading;
+    }
+
+    t[3] = bench_now();
+    for (int n = 0; n < BENCH_LOOP; n++) {
+        struct or_orientation_vec orv;
+        or_from_accel(&accel[n % 36], &orv);
+        sink += orv.pitch;
+    }
+
+    t[4] = bench_now();
+    for (int n = 0; n < BENCH_LOOP / 36; n++) {
+        or_from_accel_mag_batch(&accel_soa, &mag_soa, &orv_soa, 36);
+        sink += heading[n % 36];
+    }
+
+    t[5] = bench_now();
+
+    printf("accel+mag double  %6lu cycles/call\n", (unsigned long) ((t[1] - t[0]) / BENCH_LOOP));
+    printf("accel+mag float   %6lu cycles/call\n", (unsigned long) ((t[2] - t[1]) / BENCH_LOOP));
+    printf("accel+mag q15     %6lu cycles/call\n", (unsigned long) ((t[3] - t[2]) / BENCH_LOOP));
+    printf("accel float       %6lu cycles/call\n", (unsigned long) ((t[4] - t[3]) / BENCH_LOOP));
+    printf("accel+mag batch   %6lu cycles/sample\n", (unsigned long) ((t[5] - t[4]) / (BENCH_LOOP / 36 * 36)));
+
+    TEST_ASSERT(sink == sink);
+}
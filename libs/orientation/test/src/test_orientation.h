@@ -0,0 +1,39 @@
+#ifndef TEST_ORIENTATION_H
+#define TEST_ORIENTATION_H
+
+#include <stdint.h>
+#include <os/os_cputime.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#define BENCH_HOST  1       /* bench_now() counts host cycles */
+#else
+#define BENCH_HOST  0
+#endif
+
+/* Cycle counter on the native BSP, cputime ticks elsewhere */
+static inline uint64_t
+bench_now(void)
+{
+#if BENCH_HOST
+    return __builtin_ia32_rdtsc();
+#else
+    return os_cputime_get32();
+#endif
+}
+
+TEST_CASE_DECL(test_or_accel_error);
+TEST_CASE_DECL(test_or_accel_mag_error);
+TEST_CASE_DECL(test_or_q15_error);
+TEST_CASE_DECL(test_or_batch);
+TEST_CASE_DECL(test_or_benchmark);
+TEST_CASE_DECL(test_or_fusion_track);
+TEST_CASE_DECL(test_or_fusion_q30_track);
+TEST_CASE_DECL(test_or_fusion_replay);
+TEST_CASE_DECL(test_or_magcal);
+TEST_CASE_DECL(test_or_filter);
+
+double angle_err(double a, double b);
+void make_sample(double roll, double pitch, double heading, double a[3],
+    double m[3]);
+
+#endif /* TEST_ORIENTATION_H */
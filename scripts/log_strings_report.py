@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+#
+# The BSD License (BSD)
+#
+# Copyright (c) 2016 Adafruit Industries
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""Report log format string bytes removed by compile-time log levels.
+
+Build the same target twice, e.g. with and without BLEDIS_LOG_LEVEL /
+TSL2561_LOG_LEVEL / ILI9341_LOG_LEVEL / ADAUTIL_LOG_LEVEL raised, then:
+
+    scripts/log_strings_report.py before.elf after.elf
+
+Format strings are searched in every section loaded on the target. Linker
+scripts differ in where they put .rodata (the nRF52 one merges it into
+.text) and binary adalog adds adalog_fmt, so no section name is assumed.
+"""
+
+import re
+import struct
+import sys
+
+SHT_PROGBITS = 1
+SHF_ALLOC = 0x2
+
+# NUL terminated printable runs, like strings(1). A string placed after code
+# or data bytes is still found, its leading junk rarely passes the filters
+STRING_RE = re.compile(rb'[\x20-\x7e\t\r\n]{4,}(?=\0)')
+
+
+def elf_sections(data):
+    """Yield (name, bytes) of every loaded section of an ELF32/ELF64 LE file"""
+    if data[:4] != b'\x7fELF':
+        raise ValueError('not an ELF file')
+
+    is64 = data[4] == 2
+    if is64:
+        shoff, = struct.unpack_from('<Q', data, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from('<HHH', data, 0x3A)
+        fmt, name_at, off_at = '<IIQQQQ', 0, 4
+    else:
+        shoff, = struct.unpack_from('<I', data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from('<HHH', data, 0x2E)
+        fmt, name_at, off_at = '<IIIIII', 0, 4
+
+    headers = [struct.unpack_from(fmt, data, shoff + i * shentsize) for i in range(shnum)]
+    strtab = headers[shstrndx]
+    str_off = strtab[off_at]
+
+    for hdr in headers:
+        name_end = data.index(b'\0', str_off + hdr[name_at])
+        name = data[str_off + hdr[name_at]:name_end].decode()
+        sh_type, flags, offset, size = hdr[1], hdr[2], hdr[off_at], hdr[off_at + 1]
+        if sh_type != SHT_PROGBITS or not flags & SHF_ALLOC:
+            continue
+        yield name, data[offset:offset + size]
+
+
+def log_strings(path):
+    """Return {string: bytes} of printf-like strings in loaded sections"""
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    found = {}
+    for _name, body in elf_sections(data):
+        for match in STRING_RE.finditer(body):
+            raw = match.group()
+            text = raw.decode('ascii')
+            if '%' in text or text.endswith('\n'):
+                found[text] = len(raw) + 1
+    return found
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(__doc__)
+        return 1
+
+    before = log_strings(sys.argv[1])
+    after = log_strings(sys.argv[2])
+
+    removed = sorted(set(before) - set(after))
+    added = sorted(set(after) - set(before))
+
+    for text in removed:
+        print('  -%4d  %r' % (before[text], text))
+    for text in added:
+        print('  +%4d  %r' % (after[text], text))
+
+    saved = sum(before[t] for t in removed) - sum(after[t] for t in added)
+    print('log strings: %d -> %d, %d bytes saved' % (len(before), len(after), saved))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())